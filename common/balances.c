@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "balances.h"
+
+//makes room in state for an account per username id below num_names; new ids have no account yet
+static int reserve_accounts(balance_state_t *state, uint32_t num_names){
+    if (state->index_len < num_names){
+        int *grown = realloc(state->index, (size_t)num_names * sizeof(int));
+        if (!grown){return 1;}
+        memset(grown + state->index_len, 0xff, (size_t)(num_names - state->index_len) * sizeof(int));
+        state->index = grown;
+        state->index_len = num_names;
+    }
+    //there is at most one account per username
+    if ((uint32_t)state->dictcap < num_names){
+        balance_t *grown = realloc(state->dict, (size_t)num_names * sizeof(balance_t));
+        if (!grown){return 1;}
+        state->dict = grown;
+        state->dictcap = num_names;
+    }
+    return 0;
+}
+
+//registers the account of user (if it has none yet) and returns its position in dict
+static inline int find_account(balance_state_t *state, uint32_t user){
+    if (state->index[user] < 0){
+        state->index[user] = state->dictlength;
+        state->dict[state->dictlength].user_id = user;
+        state->dict[state->dictlength].amount = 0;
+        state->dictlength ++;
+    }
+    return state->index[user];
+}
+
+//accounts are found through state's index, so each transfer costs O(1) instead of a scan of dict
+int apply_transfers(balance_state_t *state, const uint32_t *sender, const uint32_t *recipient, const uint64_t *amount, size_t n, uint32_t num_names, uint32_t system_id){
+    size_t i;
+    if (!n){return 0;}
+    if (reserve_accounts(state, num_names)){return 1;}
+
+    //loop through the transactions to initialize balances to 0, in order of first appearance
+    for (i=0; i < n; i++){
+        if (sender[i] >= num_names || recipient[i] >= num_names){return 1;}
+        //don't track system balance
+        if (sender[i] != system_id){
+            find_account(state, sender[i]);
+        }
+        find_account(state, recipient[i]);
+    }
+
+    //looping through the transactions again to calculate balances
+    for (i=0; i < n; i++){
+        balance_t *to = &state->dict[state->index[recipient[i]]];
+        //if the sender is system: add balance to recipient account
+        if (sender[i] == system_id){
+            to->amount += amount[i];
+        }
+        //if sender is not system: check that transaction is valid and execute transaction
+        else {
+            balance_t *from = &state->dict[state->index[sender[i]]];
+            if (from->amount >= amount[i]){
+                from->amount -= amount[i];
+                to->amount += amount[i];
+            }
+        }
+    }
+
+    return 0;
+}
+
+int update_balances(balance_state_t *state, const ledger_t *ledger, int first){
+    if (ledger->length <= first){return 0;}
+    //the system account is never tracked; it may not have been seen yet
+    return apply_transfers(state, ledger->sender_id + first, ledger->recipient_id + first, ledger->amount + first,
+                           ledger->length - first, usernames.count, find_name(&usernames, "system"));
+}
+
+int calculate_balances(balance_state_t *state, const ledger_t *ledger){
+    memset(state, 0, sizeof(*state));
+    //the first row is the CSV header
+    return update_balances(state, ledger, 1);
+}
+
+void free_balances(balance_state_t *state){
+    free(state->dict);
+    free(state->index);
+    memset(state, 0, sizeof(*state));
+}
+
+//size, modification time and FNV-1a hash of both ends of the file at path; returns 1 if it can't be read
+static int fingerprint_ledger(const char *path, uint64_t *size, int64_t *mtime, uint64_t *fingerprint){
+    char buf[2 * SNAPSHOT_FINGERPRINT_BYTES];
+    struct stat st;
+    size_t head, tail;
+    FILE *in = fopen(path, "rb");
+
+    if (!in){return 1;}
+    if (fstat(fileno(in), &st)){
+        fclose(in);
+        return 1;
+    }
+    *size = (uint64_t)st.st_size;
+    *mtime = (int64_t)st.st_mtime;
+    head = (*size < SNAPSHOT_FINGERPRINT_BYTES) ? *size : SNAPSHOT_FINGERPRINT_BYTES;
+    tail = (*size - head < SNAPSHOT_FINGERPRINT_BYTES) ? *size - head : SNAPSHOT_FINGERPRINT_BYTES;
+    int status = fread(buf, 1, head, in) != head
+                 || fseek(in, (long)(*size - tail), SEEK_SET) || fread(buf + head, 1, tail, in) != tail;
+    fclose(in);
+    *fingerprint = hash_name(buf, head + tail);
+    return status;
+}
+
+//checks that count items of width bytes starting at offset are inside a file of size bytes
+static int section_fits(uint64_t offset, uint64_t count, uint64_t width, uint64_t size){
+    return offset <= size && count <= (size - offset) / width;
+}
+
+//the rows and names come first, then each snapshot as it is taken, then the index; the header goes in last
+int write_balance_snapshots(const char *path, const char *ledger_path, const ledger_t *sorted, int interval){
+    snapshot_header_t header;
+    balance_state_t state = {0};
+    char tmp_path[PATH_MAX];
+    uint64_t rows = (sorted->length > 1) ? (uint64_t)sorted->length - 1 : 0, pos;
+    int first, status = 0;
+    ledger_t chunk = *sorted;
+
+    memset(&header, 0, sizeof(header));
+    if (fingerprint_ledger(ledger_path, &header.ledger_size, &header.ledger_mtime, &header.ledger_fingerprint)){return 1;}
+    memcpy(header.magic, SNAPSHOT_MAGIC, 8);
+    header.version = SNAPSHOT_VERSION;
+    header.requested_interval = (interval < 1) ? 1 : interval;
+    //every snapshot holds at most one balance per username
+    uint64_t min_interval = rows * usernames.count * sizeof(balance_t) / BALANCE_SNAPSHOT_BUDGET + 1;
+    if (min_interval < header.requested_interval){min_interval = header.requested_interval;}
+    header.interval = (min_interval > INT_MAX) ? INT_MAX : (uint32_t)min_interval;
+    header.system_id = find_name(&usernames, "system");
+    header.num_names = usernames.count;
+    header.num_rows = rows;
+
+    //lay out the sections, each one 8 byte aligned
+    pos = sizeof(snapshot_header_t);
+    header.names_offset = pos;
+    pos += (uint64_t)usernames.count * USERNAME_LEN;
+    pos = (pos + 7) & ~(uint64_t)7;
+    header.created_at_offset = pos;
+    pos += rows * sizeof(int64_t);
+    header.sender_offset = pos;
+    pos += rows * sizeof(uint32_t);
+    pos = (pos + 7) & ~(uint64_t)7;
+    header.recipient_offset = pos;
+    pos += rows * sizeof(uint32_t);
+    pos = (pos + 7) & ~(uint64_t)7;
+    header.amount_offset = pos;
+    pos += rows * sizeof(uint64_t);
+
+    snapshot_entry_t *index = malloc((rows / header.interval + 1) * sizeof(snapshot_entry_t));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *out = index ? fopen(tmp_path, "wb") : NULL;
+    if (!out){
+        free(index);
+        return 1;
+    }
+
+    //gaps between sections are left as holes, which read back as zeros; created_at is written as time_t, 64 bits here
+    status = fwrite(&header, sizeof(header), 1, out) != 1
+             || fwrite(usernames.names, USERNAME_LEN, usernames.count, out) != usernames.count
+             || fseek(out, (long)header.created_at_offset, SEEK_SET) || fwrite(sorted->created_at + 1, sizeof(time_t), rows, out) != rows
+             || fseek(out, (long)header.sender_offset, SEEK_SET) || fwrite(sorted->sender_id + 1, sizeof(uint32_t), rows, out) != rows
+             || fseek(out, (long)header.recipient_offset, SEEK_SET) || fwrite(sorted->recipient_id + 1, sizeof(uint32_t), rows, out) != rows
+             || fseek(out, (long)header.amount_offset, SEEK_SET) || fwrite(sorted->amount + 1, sizeof(uint64_t), rows, out) != rows;
+
+    //folds the rows in one interval at a time, which registers accounts in the same order as one pass
+    //the rows after the last full interval are always replayed, so they get no snapshot
+    for (first=1; !status && first < sorted->length; first = chunk.length){
+        chunk.length = ((uint64_t)(sorted->length - first) > header.interval) ? first + (int)header.interval : sorted->length;
+        status = update_balances(&state, &chunk, first);
+        if (!status && chunk.length < sorted->length){
+            snapshot_entry_t *snap = &index[header.num_snaps++];
+            snap->rows = chunk.length - 1;
+            snap->created_at = sorted->created_at[chunk.length - 1];
+            snap->dictlength = state.dictlength;
+            snap->offset = pos;
+            pos += snap->dictlength * sizeof(balance_t);
+            status = fwrite(state.dict, sizeof(balance_t), state.dictlength, out) != (size_t)state.dictlength;
+        }
+    }
+
+    header.index_offset = pos;
+    status = status || fwrite(index, sizeof(snapshot_entry_t), header.num_snaps, out) != header.num_snaps
+             || fseek(out, 0, SEEK_SET) || fwrite(&header, sizeof(header), 1, out) != 1;
+    status = fclose(out) || status;
+    free_balances(&state);
+    free(index);
+    if (status || rename(tmp_path, path)){
+        unlink(tmp_path);
+        return 1;
+    }
+    return 0;
+}
+
+int open_balance_snapshots(const char *path, const char *ledger_path, int interval, balance_snapshots_t *snaps){
+    uint64_t size, fingerprint;
+    int64_t mtime;
+    struct stat st;
+
+    memset(snaps, 0, sizeof(*snaps));
+    if (fingerprint_ledger(ledger_path, &size, &mtime, &fingerprint)){return 1;}
+    int fd = open(path, O_RDONLY);
+    if (fd < 0){return 1;}
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(snapshot_header_t)){
+        close(fd);
+        return 1;
+    }
+    const char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED){return 1;}
+    snaps->map = map;
+    snaps->size = st.st_size;
+    snaps->header = (const snapshot_header_t *)map;
+
+    //it must have been written for the ledger as it is now, with every section inside the file
+    const snapshot_header_t *h = snaps->header;
+    if (memcmp(h->magic, SNAPSHOT_MAGIC, 8) || h->version != SNAPSHOT_VERSION || (interval && h->requested_interval != (uint32_t)interval)
+        || h->ledger_size != size || h->ledger_mtime != mtime || h->ledger_fingerprint != fingerprint
+        || h->num_names > UINT32_MAX || h->num_rows > INT_MAX
+        || !section_fits(h->names_offset, h->num_names, USERNAME_LEN, snaps->size)
+        || !section_fits(h->created_at_offset, h->num_rows, sizeof(int64_t), snaps->size)
+        || !section_fits(h->sender_offset, h->num_rows, sizeof(uint32_t), snaps->size)
+        || !section_fits(h->recipient_offset, h->num_rows, sizeof(uint32_t), snaps->size)
+        || !section_fits(h->amount_offset, h->num_rows, sizeof(uint64_t), snaps->size)
+        || !section_fits(h->index_offset, h->num_snaps, sizeof(snapshot_entry_t), snaps->size)){
+        close_balance_snapshots(snaps);
+        return 1;
+    }
+    snaps->names = (const char (*)[USERNAME_LEN])(map + h->names_offset);
+    snaps->created_at = (const int64_t *)(map + h->created_at_offset);
+    snaps->sender = (const uint32_t *)(map + h->sender_offset);
+    snaps->recipient = (const uint32_t *)(map + h->recipient_offset);
+    snaps->amount = (const uint64_t *)(map + h->amount_offset);
+    snaps->index = (const snapshot_entry_t *)(map + h->index_offset);
+    return 0;
+}
+
+//only the chosen snapshot and the rows after it are touched, so a query costs one interval however long the ledger is
+int snapshot_balances_as_of(const balance_snapshots_t *snaps, time_t as_of, balance_state_t *state){
+    const snapshot_header_t *h = snaps->header;
+    const snapshot_entry_t *snap = NULL;
+    uint64_t lo = 0, hi = h->num_snaps, mid, start, end, i;
+
+    //latest snapshot whose last row was created at or before as_of
+    while (lo < hi){
+        mid = lo + (hi - lo) / 2;
+        if (snaps->index[mid].created_at <= as_of){lo = mid + 1;}
+        else {hi = mid;}
+    }
+    if (lo > 0){snap = &snaps->index[lo - 1];}
+    start = snap ? snap->rows : 0;
+
+    //the next snapshot's last row is after as_of, so the tail is at most one interval long
+    for (end=start; end < h->num_rows && snaps->created_at[end] <= as_of; end++){}
+
+    //restoring the snapshot, with room for every account the tail can add
+    if (reserve_accounts(state, (uint32_t)h->num_names)){return 1;}
+    if (snap){
+        if (snap->rows > h->num_rows || snap->dictlength > h->num_names || !section_fits(snap->offset, snap->dictlength, sizeof(balance_t), snaps->size)){return 1;}
+        memcpy(state->dict, snaps->map + snap->offset, snap->dictlength * sizeof(balance_t));
+        state->dictlength = (int)snap->dictlength;
+        for (i=0; i < snap->dictlength; i++){
+            if (state->dict[i].user_id >= h->num_names){return 1;}
+            state->index[state->dict[i].user_id] = (int)i;
+        }
+    }
+
+    //replaying rows [start, end)
+    return apply_transfers(state, snaps->sender + start, snaps->recipient + start, snaps->amount + start, end - start, (uint32_t)h->num_names, h->system_id);
+}
+
+void close_balance_snapshots(balance_snapshots_t *snaps){
+    if (snaps->map){
+        munmap((void *)snaps->map, snaps->size);
+    }
+    memset(snaps, 0, sizeof(*snaps));
+}
@@ -0,0 +1,155 @@
+#ifndef BALANCES_H
+#define BALANCES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include "ledger.h"
+
+//transactions between balance snapshots unless --snapshot-every says otherwise
+#define BALANCE_SNAPSHOT_INTERVAL (1 << 16)
+//bytes the snapshots may take on disk; the interval is widened if the accounts would need more
+#define BALANCE_SNAPSHOT_BUDGET (1ULL << 30)
+
+//magic bytes at the start of a balance snapshot file
+#define SNAPSHOT_MAGIC "TXSNAPSH"
+//snapshot file format version this library reads
+#define SNAPSHOT_VERSION 1
+//bytes at each end of the ledger fingerprinted to notice it was rewritten
+#define SNAPSHOT_FINGERPRINT_BYTES 4096
+
+/**
+ * @brief Represents an account balance.
+ *
+ * @param user_id The account holder's interned username.
+ * @param amount The account balance.
+ */
+typedef struct balance_t {
+    uint32_t user_id;
+    uint64_t amount;
+} balance_t;
+
+/**
+ * @brief Represents the balances of a set of accounts and the index used to find them.
+ *
+ * @param dict Balance of every account, in order of first appearance.
+ * @param dictlength Number of accounts.
+ * @param dictcap Capacity of dict.
+ * @param index Position in dict of every username id, -1 for usernames without an account.
+ * @param index_len Number of username ids index covers.
+ */
+typedef struct balance_state_t {
+    balance_t *dict;
+    int dictlength;
+    int dictcap;
+    int *index;
+    uint32_t index_len;
+} balance_state_t;
+
+/**
+ * @brief Header of a balance snapshot file. The file holds the time sorted ledger and the balances every interval rows, in native byte order: it is a cache of one ledger, not an interchange format.
+ *
+ * @param magic SNAPSHOT_MAGIC, not null terminated.
+ * @param version SNAPSHOT_VERSION.
+ * @param interval Rows between snapshots.
+ * @param requested_interval Interval asked for when writing; interval is wider if the snapshots would not fit BALANCE_SNAPSHOT_BUDGET.
+ * @param system_id Username id of the system account, UINT32_MAX if it never appears.
+ * @param ledger_size Size of the ledger file the snapshots were taken over.
+ * @param ledger_mtime Modification time of that file.
+ * @param ledger_fingerprint FNV-1a hash of the SNAPSHOT_FINGERPRINT_BYTES at each end of that file.
+ * @param num_names Number of usernames.
+ * @param num_rows Number of transactions (the CSV header row is not stored).
+ * @param num_snaps Number of snapshots.
+ * @param names_offset File offset of the usernames, USERNAME_LEN zero padded bytes each.
+ * @param created_at_offset File offset of the time sorted int64_t created_at column.
+ * @param sender_offset File offset of the uint32_t sender column.
+ * @param recipient_offset File offset of the uint32_t recipient column.
+ * @param amount_offset File offset of the uint64_t amount column.
+ * @param index_offset File offset of the num_snaps snapshot_entry_t, in row order.
+ */
+typedef struct snapshot_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t interval;
+    uint32_t requested_interval;
+    uint32_t system_id;
+    uint64_t ledger_size;
+    int64_t ledger_mtime;
+    uint64_t ledger_fingerprint;
+    uint64_t num_names;
+    uint64_t num_rows;
+    uint64_t num_snaps;
+    uint64_t names_offset;
+    uint64_t created_at_offset;
+    uint64_t sender_offset;
+    uint64_t recipient_offset;
+    uint64_t amount_offset;
+    uint64_t index_offset;
+} snapshot_header_t;
+
+/**
+ * @brief Represents one snapshot in a snapshot file's index.
+ *
+ * @param rows Number of sorted rows applied.
+ * @param created_at Time of the last row applied.
+ * @param dictlength Number of accounts.
+ * @param offset File offset of the dictlength balance_t, in order of first appearance.
+ */
+typedef struct snapshot_entry_t {
+    uint64_t rows;
+    int64_t created_at;
+    uint64_t dictlength;
+    uint64_t offset;
+} snapshot_entry_t;
+
+/**
+ * @brief Represents a mapped balance snapshot file.
+ *
+ * @param map The mapped file.
+ * @param size Size of the mapping.
+ * @param header The file's header.
+ * @param names Username of every id.
+ * @param created_at, sender, recipient, amount The time sorted columns.
+ * @param index The snapshots.
+ */
+typedef struct balance_snapshots_t {
+    const char *map;
+    size_t size;
+    const snapshot_header_t *header;
+    const char (*names)[USERNAME_LEN];
+    const int64_t *created_at;
+    const uint32_t *sender;
+    const uint32_t *recipient;
+    const uint64_t *amount;
+    const snapshot_entry_t *index;
+} balance_snapshots_t;
+
+//registers the accounts of n transfers in state and applies them in order; ids are below num_names
+//a transfer the sender can't cover is skipped; system_id is never tracked and never overdrawn
+int apply_transfers(balance_state_t *state, const uint32_t *sender, const uint32_t *recipient, const uint64_t *amount, size_t n, uint32_t num_names, uint32_t system_id);
+
+//applies rows [first, length) of the ledger to state, which grows as needed so batches can be folded in one at a time
+int update_balances(balance_state_t *state, const ledger_t *ledger, int first);
+
+//balances of every account after all the rows of the ledger (row 0 is the CSV header), in order of first appearance
+int calculate_balances(balance_state_t *state, const ledger_t *ledger);
+
+//frees state's balances and index, leaving it empty
+void free_balances(balance_state_t *state);
+
+//writes the snapshot file for the ledger file at ledger_path, given its rows sorted by time: the sorted rows, and the balances every interval rows
+//written through a temporary file renamed over path; returns 1 if it can't be written
+int write_balance_snapshots(const char *path, const char *ledger_path, const ledger_t *sorted, int interval);
+
+//maps the snapshot file at path; interval 0 accepts any interval
+//returns 1 if it is missing, unreadable, or was not written for the ledger at ledger_path as it is now, or with interval
+int open_balance_snapshots(const char *path, const char *ledger_path, int interval, balance_snapshots_t *snaps);
+
+//balances after the rows created at or before as_of, as pr1 prints them for the ledger cut at as_of
+//binary searches the latest snapshot at or before as_of and replays only the rows after it into state, which must be empty
+int snapshot_balances_as_of(const balance_snapshots_t *snaps, time_t as_of, balance_state_t *state);
+
+//unmaps the snapshot file
+void close_balance_snapshots(balance_snapshots_t *snaps);
+
+#endif
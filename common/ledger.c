@@ -0,0 +1,858 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <endian.h>
+#include <limits.h>
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include "ledger.h"
+
+//usernames seen during ingest; transactions only carry their ids
+intern_table_t usernames = {0};
+
+void *arena_alloc(arena_t *arena, size_t n) {
+    n = (n + 15) & ~(size_t)15;
+
+    //start a new block when the current one is full; oversized requests get a block of their own
+    if (!arena->head || arena->used + n > arena->size){
+        size_t size = n + 16 > ARENA_BLOCK_SIZE ? n + 16 : ARENA_BLOCK_SIZE;
+        char *block = malloc(size);
+        if (!block){return NULL;}
+        *(char **)block = arena->head;
+        arena->head = block;
+        arena->used = 16;
+        arena->size = size;
+    }
+
+    void *p = arena->head + arena->used;
+    arena->used += n;
+    return p;
+}
+
+void arena_release(arena_t *arena) {
+    while (arena->head){
+        char *prev = *(char **)arena->head;
+        free(arena->head);
+        arena->head = prev;
+    }
+    arena->used = 0;
+    arena->size = 0;
+}
+
+uint64_t hash_name(const char *name, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    size_t i;
+    for (i = 0; i < len; i++){
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+uint32_t intern_name(intern_table_t *table, const char *name, size_t len) {
+    size_t i, mask;
+
+    if (len > USERNAME_LEN - 1){len = USERNAME_LEN - 1;}
+
+    //grow the slots at half load
+    if (2 * ((size_t)table->count + 1) > table->cap){
+        size_t newcap = table->cap ? table->cap * 2 : 1024;
+        uint32_t *slots = calloc(newcap, sizeof(uint32_t));
+        if (!slots){
+            table->failed = 1;
+            return UINT32_MAX;
+        }
+        for (i = 0; i < table->cap; i++){
+            uint32_t id = table->slots[i];
+            if (!id){continue;}
+            size_t j = hash_name(table->names[id - 1], strlen(table->names[id - 1])) & (newcap - 1);
+            while (slots[j]){j = (j + 1) & (newcap - 1);}
+            slots[j] = id;
+        }
+        free(table->slots);
+        table->slots = slots;
+        table->cap = newcap;
+    }
+
+    //probe for the name; stored names are zero padded so the byte after a match must be 0
+    mask = table->cap - 1;
+    for (i = hash_name(name, len) & mask; table->slots[i]; i = (i + 1) & mask){
+        const char *stored = table->names[table->slots[i] - 1];
+        if (!memcmp(stored, name, len) && stored[len] == '\0'){return table->slots[i] - 1;}
+    }
+
+    //add it
+    if (table->count == table->names_cap){
+        uint32_t newcap = table->names_cap ? table->names_cap * 2 : 1024;
+        char (*names)[USERNAME_LEN] = realloc(table->names, (size_t)newcap * USERNAME_LEN);
+        if (!names){
+            table->failed = 1;
+            return UINT32_MAX;
+        }
+        table->names = names;
+        table->names_cap = newcap;
+    }
+    memset(table->names[table->count], 0, USERNAME_LEN);
+    memcpy(table->names[table->count], name, len);
+    table->slots[i] = ++table->count;
+    return table->count - 1;
+}
+
+uint32_t find_name(const intern_table_t *table, const char *name) {
+    size_t i, len = strlen(name);
+    if (!table->cap || len > USERNAME_LEN - 1){return UINT32_MAX;}
+    for (i = hash_name(name, len) & (table->cap - 1); table->slots[i]; i = (i + 1) & (table->cap - 1)){
+        if (!strcmp(table->names[table->slots[i] - 1], name)){return table->slots[i] - 1;}
+    }
+    return UINT32_MAX;
+}
+
+void free_names(intern_table_t *table) {
+    free(table->names);
+    free(table->slots);
+    memset(table, 0, sizeof(*table));
+}
+
+void free_ledger(ledger_t *ledger) {
+    free(ledger->created_at);
+    free(ledger->sender_id);
+    free(ledger->recipient_id);
+    free(ledger->amount);
+    memset(ledger, 0, sizeof(*ledger));
+}
+
+int alloc_ledger(ledger_t *ledger, int length) {
+    ledger->length = length;
+    ledger->created_at = calloc(length + 1, sizeof(time_t));
+    ledger->sender_id = calloc(length + 1, sizeof(uint32_t));
+    ledger->recipient_id = calloc(length + 1, sizeof(uint32_t));
+    ledger->amount = calloc(length + 1, sizeof(uint64_t));
+    if (!ledger->created_at || !ledger->sender_id || !ledger->recipient_id || !ledger->amount){
+        free_ledger(ledger);
+        return 4;
+    }
+    return 0;
+}
+
+int64_t parse_number(const char *p, const char *end) {
+    int64_t value = 0;
+    int negative = 0;
+
+    //skip leading whitespace and an optional sign
+    while (p < end && (*p == ' ' || *p == '\t')){p++;}
+    if (p < end && (*p == '-' || *p == '+')){
+        negative = (*p == '-');
+        p++;
+    }
+
+    //accumulate digits
+    while (p < end && *p >= '0' && *p <= '9'){
+        value = value * 10 + (*p - '0');
+        p++;
+    }
+
+    return negative ? -value : value;
+}
+
+void fill_transaction(ledger_t *ledger, int row, intern_table_t *table, const char *line, const char **commas, int ncomma, const char *end) {
+    //created_at field
+    ledger->created_at[row] = (time_t)parse_number(line, ncomma > 0 ? commas[0] : end);
+
+    //sender field
+    const char *start = ncomma > 0 ? commas[0] + 1 : end;
+    const char *stop = ncomma > 1 ? commas[1] : end;
+    ledger->sender_id[row] = intern_name(table, start, stop - start);
+
+    //recipient field
+    start = ncomma > 1 ? commas[1] + 1 : end;
+    stop = ncomma > 2 ? commas[2] : end;
+    ledger->recipient_id[row] = intern_name(table, start, stop - start);
+
+    //amount field
+    ledger->amount[row] = ncomma > 2 ? (uint64_t)parse_number(commas[2] + 1, end) : 0;
+}
+
+void parse_transaction(const char *line, const char *end, intern_table_t *table, ledger_t *ledger, int row) {
+    const char *commas[3], *p = line;
+    int ncomma = 0;
+
+    //find up to three commas
+    while (ncomma < 3 && (p = memchr(p, ',', end - p))){
+        commas[ncomma++] = p++;
+    }
+    fill_transaction(ledger, row, table, line, commas, ncomma, end);
+}
+
+//number of bytes the tokenizer scans per call; offsets fit in a uint32_t
+#define SCAN_WINDOW (1 << 16)
+
+//writes the set bits of a 64 bit delimiter mask covering buf[base, base + 64) as offsets
+static inline size_t emit_delims(uint64_t mask, size_t base, uint32_t *offs) {
+    size_t n = 0;
+    while (mask){
+        offs[n++] = (uint32_t)(base + __builtin_ctzll(mask));
+        mask &= mask - 1;
+    }
+    return n;
+}
+
+//scans the bytes after the last full 64 byte step
+static inline size_t scan_delims_tail(const char *buf, size_t i, size_t len, uint32_t *offs) {
+    size_t n = 0;
+    for (; i < len; i++){
+        if (buf[i] == ',' || buf[i] == '\n'){
+            offs[n++] = (uint32_t)i;
+        }
+    }
+    return n;
+}
+
+#if defined(__x86_64__)
+//SSE2 tokenizer: builds comma and newline bitmasks for 64 bytes per step, 16 bytes per compare
+static size_t scan_delims_sse2(const char *buf, size_t len, uint32_t *offs) {
+    const __m128i comma = _mm_set1_epi8(','), newline = _mm_set1_epi8('\n');
+    size_t i, n = 0;
+    int j;
+
+    for (i = 0; i + 64 <= len; i += 64){
+        uint64_t commas = 0, newlines = 0;
+        for (j = 0; j < 4; j++){
+            __m128i v = _mm_loadu_si128((const __m128i *)(buf + i + 16 * j));
+            commas |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, comma)) << (16 * j);
+            newlines |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)) << (16 * j);
+        }
+        n += emit_delims(commas | newlines, i, offs + n);
+    }
+    return n + scan_delims_tail(buf, i, len, offs + n);
+}
+
+//AVX2 tokenizer: same as SSE2 with 32 bytes per compare
+__attribute__((target("avx2")))
+static size_t scan_delims_avx2(const char *buf, size_t len, uint32_t *offs) {
+    const __m256i comma = _mm256_set1_epi8(','), newline = _mm256_set1_epi8('\n');
+    size_t i, n = 0;
+
+    for (i = 0; i + 64 <= len; i += 64){
+        __m256i lo = _mm256_loadu_si256((const __m256i *)(buf + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i *)(buf + i + 32));
+        uint64_t commas = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, comma))
+            | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, comma)) << 32;
+        uint64_t newlines = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, newline))
+            | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, newline)) << 32;
+        n += emit_delims(commas | newlines, i, offs + n);
+    }
+    return n + scan_delims_tail(buf, i, len, offs + n);
+}
+#endif
+
+#if !defined(__x86_64__)
+//scalar tokenizer, used when no vector unit is available
+static size_t scan_delims_scalar(const char *buf, size_t len, uint32_t *offs) {
+    size_t i, n = 0;
+    for (i = 0; i < len; i++){
+        if (buf[i] == ',' || buf[i] == '\n'){
+            offs[n++] = (uint32_t)i;
+        }
+    }
+    return n;
+}
+#endif
+
+scan_delims_fn select_scan_delims(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")){return scan_delims_avx2;}
+    return scan_delims_sse2;
+#else
+    return scan_delims_scalar;
+#endif
+}
+
+//checks that a section of count elements of width bytes at offset is aligned and inside the file
+static int section_fits(uint64_t offset, uint64_t count, uint64_t width, size_t size) {
+    return !(offset & 7) && offset <= size && count <= (size - offset) / width;
+}
+
+int load_ledger(const char *map, size_t size, ledger_t *ledger) {
+    const ledger_header_t *header = (const ledger_header_t *)map;
+    uint64_t num_rows = le64toh(header->num_rows), i;
+    uint32_t num_names = le32toh(header->num_names), n;
+    uint64_t names_offset = le64toh(header->names_offset);
+    uint64_t created_at_offset = le64toh(header->created_at_offset);
+    uint64_t sender_offset = le64toh(header->sender_offset);
+    uint64_t recipient_offset = le64toh(header->recipient_offset);
+    uint64_t amount_offset = le64toh(header->amount_offset);
+
+    //check the header against the file before touching any column
+    if (le32toh(header->version) != LEDGER_VERSION || num_rows >= INT_MAX){return 5;}
+    if (!section_fits(names_offset, num_names, sizeof(uint32_t), size)
+        || !section_fits(created_at_offset, num_rows, sizeof(int64_t), size)
+        || !section_fits(sender_offset, num_rows, sizeof(uint32_t), size)
+        || !section_fits(recipient_offset, num_rows, sizeof(uint32_t), size)
+        || !section_fits(amount_offset, num_rows, sizeof(uint64_t), size)){return 5;}
+
+    const uint32_t *name_end = (const uint32_t *)(map + names_offset);
+    const char *blob = (const char *)(name_end + num_names);
+    const int64_t *created_at = (const int64_t *)(map + created_at_offset);
+    const uint32_t *sender = (const uint32_t *)(map + sender_offset);
+    const uint32_t *recipient = (const uint32_t *)(map + recipient_offset);
+    const uint64_t *amount = (const uint64_t *)(map + amount_offset);
+
+    //the dictionary's end offsets must be increasing and stay inside the file
+    uint32_t prev = 0;
+    for (n = 0; n < num_names; n++){
+        uint32_t cur = le32toh(name_end[n]);
+        if (cur < prev || (size_t)(blob - map) + cur > size){return 5;}
+        prev = cur;
+    }
+
+    //intern the dictionary, remembering the id of every dictionary index
+    uint32_t *ids = malloc((size_t)num_names * sizeof(uint32_t) + 1);
+    if (!ids){return 4;}
+    for (n = 0, prev = 0; n < num_names; n++){
+        uint32_t cur = le32toh(name_end[n]);
+        ids[n] = intern_name(&usernames, blob + prev, cur - prev);
+        prev = cur;
+    }
+    if (usernames.failed){
+        free(ids);
+        return 4;
+    }
+
+    //create the columns and set the length:
+    if (alloc_ledger(ledger, (int)num_rows + 1)){
+        free(ids);
+        return 4;
+    }
+
+    //copy the columns one at a time, remapping the username columns through ids
+    for (i = 0; i < num_rows; i++){
+        ledger->created_at[i + 1] = (time_t)le64toh(created_at[i]);
+    }
+    for (i = 0; i < num_rows; i++){
+        ledger->amount[i + 1] = le64toh(amount[i]);
+    }
+    for (i = 0; i < num_rows; i++){
+        uint32_t s = le32toh(sender[i]), r = le32toh(recipient[i]);
+        if (s >= num_names || r >= num_names){
+            free(ids);
+            free_ledger(ledger);
+            return 5;
+        }
+        ledger->sender_id[i + 1] = ids[s];
+        ledger->recipient_id[i + 1] = ids[r];
+    }
+
+    free(ids);
+    return 0;
+}
+
+//smallest byte range worth giving its own parsing thread
+#define MIN_CHUNK_BYTES (1 << 20)
+
+/**
+ * @brief Represents the part of the mapped CSV parsed by one thread.
+ * 
+ * @param begin First byte of the range, always the start of a line.
+ * @param end One past the last byte of the range, always just after a '\n' or the end of the file.
+ * @param num_rows Number of lines in the range (set by the counting pass).
+ * @param ledger Columns the range is parsed into.
+ * @param first_row Row of the range's first line (set from the prefix sum of num_rows).
+ * @param scan_delims Tokenizer used by the parsing pass.
+ * @param table Where the range's usernames are interned: the global table for the first range, names for the others.
+ * @param names Usernames first seen in this range, merged into the global table after parsing.
+ * @param remap Global id of every id in names (set by the merge).
+ * @param status 0 on success, nonzero if the parsing pass could not allocate memory.
+ */
+typedef struct parse_chunk_t {
+    const char *begin;
+    const char *end;
+    int num_rows;
+    ledger_t *ledger;
+    int first_row;
+    scan_delims_fn scan_delims;
+    intern_table_t *table;
+    intern_table_t names;
+    uint32_t *remap;
+    int status;
+} parse_chunk_t;
+
+//counting pass: number of lines in the chunk (a last line without '\n' still counts)
+static void * count_chunk_lines(void * chunk_ptr) {
+    parse_chunk_t *chunk = (parse_chunk_t *)chunk_ptr;
+    const char *p, *nl;
+    int num_lines = 0;
+
+    for (p = chunk->begin; p < chunk->end && (nl = memchr(p, '\n', chunk->end - p)); p = nl + 1){
+        num_lines ++;
+    }
+    if (p < chunk->end){num_lines ++;}
+
+    chunk->num_rows = num_lines;
+    return NULL;
+}
+
+//parsing pass: fills the chunk's rows of the ledger a window at a time from the tokenizer's delimiter offsets
+static void * parse_chunk(void * chunk_ptr) {
+    parse_chunk_t *chunk = (parse_chunk_t *)chunk_ptr;
+    const char *begin = chunk->begin, *end = chunk->end, *commas[3], *line, *nl;
+    size_t size = end - begin, pos = 0, n, k;
+    int idx = 0, ncomma;
+
+    //offsets of the delimiters in the current window
+    uint32_t *offs = malloc(SCAN_WINDOW * sizeof(uint32_t));
+    if (!offs){
+        chunk->status = 4;
+        return NULL;
+    }
+
+    while (idx < chunk->num_rows){
+        size_t wlen = size - pos < SCAN_WINDOW ? size - pos : SCAN_WINDOW;
+        n = chunk->scan_delims(begin + pos, wlen, offs);
+
+        //walk the delimiters; every '\n' completes a line
+        line = begin + pos;
+        ncomma = 0;
+        for (k = 0; k < n; k++){
+            const char *delim = begin + pos + offs[k];
+            if (*delim == ','){
+                if (ncomma < 3){commas[ncomma++] = delim;}
+                continue;
+            }
+            fill_transaction(chunk->ledger, chunk->first_row + idx++, chunk->table, line, commas, ncomma, delim);
+            line = delim + 1;
+            ncomma = 0;
+        }
+
+        //last window: the final line may not end with '\n'
+        if (pos + wlen == size){
+            if (line < end){
+                fill_transaction(chunk->ledger, chunk->first_row + idx++, chunk->table, line, commas, ncomma, end);
+            }
+            break;
+        }
+
+        //a line longer than the whole window is parsed on its own
+        if (line == begin + pos){
+            nl = memchr(line, '\n', end - line);
+            if (!nl){nl = end;}
+            parse_transaction(line, nl, chunk->table, chunk->ledger, chunk->first_row + idx++);
+            line = nl + 1;
+        }
+
+        //the next window starts at the first incomplete line
+        pos = line - begin;
+    }
+
+    free(offs);
+    chunk->status = chunk->table->failed ? 4 : 0;
+    return NULL;
+}
+
+//remapping pass: rewrites the chunk's usernames from its own ids to global ids
+static void * remap_chunk(void * chunk_ptr) {
+    parse_chunk_t *chunk = (parse_chunk_t *)chunk_ptr;
+    uint32_t *sender_id = chunk->ledger->sender_id + chunk->first_row;
+    uint32_t *recipient_id = chunk->ledger->recipient_id + chunk->first_row;
+    int i;
+
+    for (i = 0; i < chunk->num_rows; i++){
+        sender_id[i] = chunk->remap[sender_id[i]];
+        recipient_id[i] = chunk->remap[recipient_id[i]];
+    }
+    return NULL;
+}
+
+int read_transactions(const char *filename, ledger_t *ledger, int threads) {
+    // check for bad inputs.
+    if (!filename || !ledger){return 1;}
+
+    // open file:
+    int fd = open(filename, O_RDONLY);
+
+    //check if there was an error opening the file.
+    if (fd < 0){return 2;}
+
+    //get the file size to map the whole file
+    struct stat st;
+    if (fstat(fd, &st) < 0){
+        close(fd);
+        return 2;
+    }
+    size_t size = (size_t)st.st_size;
+
+    //an empty file has no lines
+    if (size == 0){
+        close(fd);
+        *ledger = (ledger_t){0};
+        return 0;
+    }
+
+    //map the file; the descriptor is not needed after mapping
+    const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED){return 3;}
+    madvise((void *)map, size, MADV_SEQUENTIAL);
+
+    //binary ledgers written by csv2bin are loaded column by column instead of parsed
+    if (size >= sizeof(ledger_header_t) && !memcmp(map, LEDGER_MAGIC, 8)){
+        int status = load_ledger(map, size, ledger);
+        munmap((void *)map, size);
+        return status;
+    }
+
+    const char *end = map + size, *nl;
+    int i, nchunks, status = 0;
+
+    //one chunk per thread, but small files are not worth splitting
+    nchunks = threads;
+    if ((size_t)nchunks > size / MIN_CHUNK_BYTES){nchunks = size / MIN_CHUNK_BYTES;}
+    if (nchunks < 1){nchunks = 1;}
+
+    parse_chunk_t *chunks = calloc(nchunks, sizeof(parse_chunk_t));
+    pthread_t *thread_array = malloc(nchunks * sizeof(pthread_t));
+    if (!chunks || !thread_array){
+        free(chunks);
+        free(thread_array);
+        munmap((void *)map, size);
+        return 4;
+    }
+
+    //the first line is the CSV header; row 0 stands in for it and stays zeroed
+    nl = memchr(map, '\n', size);
+    const char *data = nl ? nl + 1 : end;
+
+    //split the rest of the file into even byte ranges, moving each boundary past the next '\n'
+    scan_delims_fn scan_delims = select_scan_delims();
+    for (i = 0; i < nchunks; i++){
+        chunks[i].begin = (i == 0) ? data : chunks[i - 1].end;
+        chunks[i].end = end;
+        chunks[i].scan_delims = scan_delims;
+        chunks[i].table = (i == 0) ? &usernames : &chunks[i].names;
+        if (i < nchunks - 1){
+            const char *split = map + size / nchunks * (i + 1);
+            if (split < chunks[i].begin){split = chunks[i].begin;}
+            nl = memchr(split, '\n', end - split);
+            if (nl){chunks[i].end = nl + 1;}
+        }
+    }
+
+    //counting pass, one thread per chunk
+    for (i = 0; i < nchunks; i++){
+        pthread_create(&thread_array[i], NULL, count_chunk_lines, &chunks[i]);
+    }
+    for (i = 0; i < nchunks; i++){
+        pthread_join(thread_array[i], NULL);
+    }
+
+    //prefix sum of the row counts gives every chunk its rows, keeping file order
+    int num_lines = 1;
+    for (i = 0; i < nchunks; i++){
+        num_lines += chunks[i].num_rows;
+    }
+
+    //create the columns and set the length:
+    if (alloc_ledger(ledger, num_lines)){
+        free(chunks);
+        free(thread_array);
+        munmap((void *)map, size);
+        return 4;
+    }
+
+    int first_row = 1;
+    for (i = 0; i < nchunks; i++){
+        chunks[i].ledger = ledger;
+        chunks[i].first_row = first_row;
+        first_row += chunks[i].num_rows;
+    }
+
+    //parsing pass, one thread per chunk
+    for (i = 0; i < nchunks; i++){
+        pthread_create(&thread_array[i], NULL, parse_chunk, &chunks[i]);
+    }
+    for (i = 0; i < nchunks; i++){
+        pthread_join(thread_array[i], NULL);
+        if (chunks[i].status){status = chunks[i].status;}
+    }
+
+    //merge the other ranges' usernames into the global table in file order
+    for (i = 1; !status && i < nchunks; i++){
+        uint32_t j;
+        chunks[i].remap = malloc((size_t)chunks[i].names.count * sizeof(uint32_t) + 1);
+        if (!chunks[i].remap){
+            status = 4;
+            break;
+        }
+        for (j = 0; j < chunks[i].names.count; j++){
+            chunks[i].remap[j] = intern_name(&usernames, chunks[i].names.names[j], strlen(chunks[i].names.names[j]));
+        }
+        if (usernames.failed){status = 4;}
+    }
+
+    //remapping pass, one thread per range after the first
+    if (!status){
+        for (i = 1; i < nchunks; i++){
+            pthread_create(&thread_array[i], NULL, remap_chunk, &chunks[i]);
+        }
+        for (i = 1; i < nchunks; i++){
+            pthread_join(thread_array[i], NULL);
+        }
+    }
+
+    for (i = 1; i < nchunks; i++){
+        free_names(&chunks[i].names);
+        free(chunks[i].remap);
+    }
+    free(chunks);
+    free(thread_array);
+
+    //unmapping the file
+    munmap((void *)map, size);
+
+    //a partly parsed ledger is of no use
+    if (status){
+        free_ledger(ledger);
+    }
+
+    return status;
+}
+
+int is_stream(const char *name){
+    return !strcmp(name, "-") || !strcmp(name, "--stream");
+}
+
+int read_batch(FILE *in, ledger_t *batch, int hold_partial){
+    char line[256];
+    int len = 1;
+
+    while (len <= STREAM_BATCH && NULL != fgets(line, sizeof(line), in)){
+        //a last line that is still being written is left for the next read
+        if (hold_partial && feof(in) && !strchr(line, '\n')){
+            fseek(in, -(long)strlen(line), SEEK_CUR);
+            break;
+        }
+        parse_transaction(line, line + strcspn(line, "\n"), &usernames, batch, len++);
+    }
+    batch->length = len;
+    return len;
+}
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+//smallest number of keys worth handing to a sort thread
+#define MIN_SORT_SLICE (1 << 16)
+
+/**
+ * @brief Represents a transaction's position in the sort by time.
+ * 
+ * @param key The transaction's datetime with the sign bit flipped, so unsigned byte order matches time order.
+ * @param row The transaction's row in the ledger.
+ */
+typedef struct sort_key_t {
+    uint64_t key;
+    int row;
+} sort_key_t;
+
+/**
+ * @brief Represents one thread's contiguous slice of the keys during a radix sort pass.
+ * 
+ * @param src The keys in the order of the previous pass.
+ * @param dst Where this pass writes the keys.
+ * @param begin First key of the slice.
+ * @param end One past the last key of the slice.
+ * @param shift Position of the byte this pass sorts on.
+ * @param count The slice's histogram of that byte, then the next dst position for each bucket.
+ */
+typedef struct radix_slice_t {
+    const sort_key_t *src;
+    sort_key_t *dst;
+    int begin;
+    int end;
+    int shift;
+    int count[RADIX_BUCKETS];
+} radix_slice_t;
+
+//counts the keys of the slice per bucket of the current byte
+static void *radix_histogram(void *arg){
+    radix_slice_t *slice = (radix_slice_t *)arg;
+    int i, shift = slice->shift;
+    memset(slice->count, 0, sizeof(slice->count));
+    for (i=slice->begin; i < slice->end; i++){
+        slice->count[(slice->src[i].key >> shift) & (RADIX_BUCKETS - 1)] ++;
+    }
+    return NULL;
+}
+
+//moves the keys of the slice to their bucket positions; keys of a bucket keep their relative order
+static void *radix_scatter(void *arg){
+    radix_slice_t *slice = (radix_slice_t *)arg;
+    int i, shift = slice->shift;
+    for (i=slice->begin; i < slice->end; i++){
+        slice->dst[slice->count[(slice->src[i].key >> shift) & (RADIX_BUCKETS - 1)] ++] = slice->src[i];
+    }
+    return NULL;
+}
+
+//runs fn on every slice, slice 0 on the calling thread; a slice whose thread can't be started runs inline
+static void run_slices(void *(*fn)(void *), radix_slice_t *slices, pthread_t *threads, int nslices){
+    int i;
+    char *started = calloc(nslices, 1);
+    for (i=1; i < nslices; i++){
+        if (!started || pthread_create(&threads[i], NULL, fn, &slices[i])){
+            fn(&slices[i]);
+        }
+        else {
+            started[i] = 1;
+        }
+    }
+    fn(&slices[0]);
+    for (i=1; i < nslices; i++){
+        if (started && started[i]){
+            pthread_join(threads[i], NULL);
+        }
+    }
+    free(started);
+}
+
+//stable LSD radix sort of n keys, one byte per pass, over up to threads_wanted threads
+//bytes that are equal in every key are skipped, so a ledger spanning a few years only takes about four passes
+static int radix_sort_keys(sort_key_t *keys, int n, int threads_wanted){
+    int i, b, s, nslices = n / MIN_SORT_SLICE;
+    uint64_t varying = 0;
+    if (nslices > threads_wanted){nslices = threads_wanted;}
+    if (nslices < 1){nslices = 1;}
+
+    sort_key_t *tmp = malloc(n * sizeof(sort_key_t));
+    radix_slice_t *slices = malloc(nslices * sizeof(radix_slice_t));
+    pthread_t *threads = malloc(nslices * sizeof(pthread_t));
+    if (!tmp || !slices || !threads){
+        free(tmp);
+        free(slices);
+        free(threads);
+        return 4;
+    }
+
+    //finding the bytes that differ between keys
+    for (i=1; i < n; i++){
+        varying |= keys[i].key ^ keys[0].key;
+    }
+
+    sort_key_t *src = keys, *dst = tmp, *swap;
+    for (s=0; s < nslices; s++){
+        slices[s].begin = (int)((long)n * s / nslices);
+        slices[s].end = (int)((long)n * (s + 1) / nslices);
+    }
+    for (int shift = 0; shift < 64; shift += RADIX_BITS){
+        if (!((varying >> shift) & (RADIX_BUCKETS - 1))){continue;}
+        for (s=0; s < nslices; s++){
+            slices[s].src = src;
+            slices[s].dst = dst;
+            slices[s].shift = shift;
+        }
+        run_slices(radix_histogram, slices, threads, nslices);
+        //bucket by bucket, each slice writes after the slices before it, which keeps the sort stable
+        int offset = 0;
+        for (b=0; b < RADIX_BUCKETS; b++){
+            for (s=0; s < nslices; s++){
+                int count = slices[s].count[b];
+                slices[s].count[b] = offset;
+                offset += count;
+            }
+        }
+        run_slices(radix_scatter, slices, threads, nslices);
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+    //an odd number of passes leaves the sorted keys in tmp
+    if (src != keys){
+        memcpy(keys, src, n * sizeof(sort_key_t));
+    }
+
+    free(tmp);
+    free(slices);
+    free(threads);
+    return 0;
+}
+
+//sorts the keys of rows [first, first + n) of the ledger by time with up to threads threads; NULL if out of memory
+static sort_key_t *sort_keys_by_time(const ledger_t *ledger, int first, int n, int threads){
+    int i;
+    sort_key_t *keys = malloc(n * sizeof(sort_key_t));
+    if (!keys){return NULL;}
+    for (i=0; i < n; i++){
+        keys[i].key = (uint64_t)ledger->created_at[first + i] ^ (1ULL << 63);
+        keys[i].row = first + i;
+    }
+    //keys start in row order, so equal times stay in file order
+    if (radix_sort_keys(keys, n, threads)){
+        free(keys);
+        return NULL;
+    }
+    return keys;
+}
+
+//writes the rows of src named by the n sorted keys to rows [first, first + n) of dst, one column per pass
+//dst may be src: every column is gathered into a scratch buffer before it is copied back
+static int gather_rows(const ledger_t *src, ledger_t *dst, int first, const sort_key_t *keys, int n){
+    int i;
+    uint32_t *ids = malloc(n * sizeof(uint32_t));
+    uint64_t *amounts = malloc(n * sizeof(uint64_t));
+    if (!ids || !amounts){
+        free(ids);
+        free(amounts);
+        return 4;
+    }
+    for (i=0; i < n; i++){
+        ids[i] = src->sender_id[keys[i].row];
+    }
+    memcpy(dst->sender_id + first, ids, n * sizeof(uint32_t));
+    for (i=0; i < n; i++){
+        ids[i] = src->recipient_id[keys[i].row];
+    }
+    memcpy(dst->recipient_id + first, ids, n * sizeof(uint32_t));
+    for (i=0; i < n; i++){
+        amounts[i] = src->amount[keys[i].row];
+    }
+    memcpy(dst->amount + first, amounts, n * sizeof(uint64_t));
+    //the sorted times are already in the keys
+    for (i=0; i < n; i++){
+        dst->created_at[first + i] = (time_t)(keys[i].key ^ (1ULL << 63));
+    }
+    free(ids);
+    free(amounts);
+    return 0;
+}
+
+int sort_ledger(ledger_t *ledger, int first, int threads){
+    int n = ledger->length - first;
+    if (n < 2){return 0;}
+
+    sort_key_t *keys = sort_keys_by_time(ledger, first, n, threads);
+    if (!keys){return 4;}
+    int status = gather_rows(ledger, ledger, first, keys, n);
+    free(keys);
+    return status;
+}
+
+int sorted_view(const ledger_t *ledger, ledger_t *view, int threads){
+    int n = ledger->length - 1;
+    if (alloc_ledger(view, ledger->length)){return 4;}
+    if (n < 1){return 0;}
+
+    sort_key_t *keys = sort_keys_by_time(ledger, 1, n, threads);
+    if (!keys){
+        free_ledger(view);
+        return 4;
+    }
+    int status = gather_rows(ledger, view, 1, keys, n);
+    free(keys);
+    if (status){free_ledger(view);}
+    return status;
+}
@@ -0,0 +1,166 @@
+#ifndef LEDGER_H
+#define LEDGER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+//longest username kept, terminator included; longer names are truncated when interned
+#define USERNAME_LEN 80
+
+//number of transactions read from a stream per batch
+#define STREAM_BATCH 4096
+
+//bytes in each block an arena carves allocations from
+#define ARENA_BLOCK_SIZE (1 << 20)
+
+//magic bytes at the start of a binary ledger written by tools/csv2bin
+#define LEDGER_MAGIC "TXLEDGER"
+//binary ledger format version this library reads
+#define LEDGER_VERSION 1
+
+/**
+ * @brief Represents the transactions as columns: transaction i is created_at[i], sender_id[i], recipient_id[i] and amount[i].
+ *
+ * @param length Number of transactions; row 0 stands in for the CSV header.
+ * @param created_at The datetime at which the user created each transaction.
+ * @param sender_id The sender's interned username.
+ * @param recipient_id The recipient's interned username.
+ * @param amount The amount transferred from sender to recipient.
+ */
+typedef struct ledger_t {
+    int length;
+    time_t *created_at;
+    uint32_t *sender_id;
+    uint32_t *recipient_id;
+    uint64_t *amount;
+} ledger_t;
+
+/**
+ * @brief Interning table mapping usernames to dense 32 bit ids.
+ *
+ * @param names Username of every id, zero padded to USERNAME_LEN.
+ * @param count Number of distinct usernames (ids are 0 to count - 1).
+ * @param names_cap Capacity of names.
+ * @param slots Open addressing table of id + 1 (0 is an empty slot).
+ * @param cap Number of slots, always a power of two.
+ * @param failed Set when the table could not grow; ids returned after that are UINT32_MAX.
+ */
+typedef struct intern_table_t {
+    char (*names)[USERNAME_LEN];
+    uint32_t count;
+    uint32_t names_cap;
+    uint32_t *slots;
+    size_t cap;
+    int failed;
+} intern_table_t;
+
+/**
+ * @brief Represents a bump allocator: allocations are carved out of large blocks
+ * and are only ever released all at once.
+ *
+ * @param head Most recent block; every block starts with a pointer to the previous one.
+ * @param used Bytes of head already handed out.
+ * @param size Size of head in bytes.
+ */
+typedef struct arena_t {
+    char *head;
+    size_t used;
+    size_t size;
+} arena_t;
+
+/**
+ * @brief Header of a binary columnar ledger (see tools/csv2bin.c). Every field in the file is little-endian.
+ *
+ * @param magic LEDGER_MAGIC, not null terminated.
+ * @param version LEDGER_VERSION.
+ * @param num_names Number of distinct usernames in the dictionary.
+ * @param num_rows Number of transactions (the CSV header row is not stored).
+ * @param names_offset File offset of the dictionary: num_names uint32_t end offsets followed by the name bytes.
+ * @param created_at_offset File offset of the int64_t created_at column.
+ * @param sender_offset File offset of the uint32_t sender column (dictionary indexes).
+ * @param recipient_offset File offset of the uint32_t recipient column (dictionary indexes).
+ * @param amount_offset File offset of the uint64_t amount column.
+ */
+typedef struct ledger_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_names;
+    uint64_t num_rows;
+    uint64_t names_offset;
+    uint64_t created_at_offset;
+    uint64_t sender_offset;
+    uint64_t recipient_offset;
+    uint64_t amount_offset;
+} ledger_header_t;
+
+//a tokenizer writes the offset of every ',' and '\n' in buf[0, len) to offs and returns how many it found
+typedef size_t (*scan_delims_fn)(const char *buf, size_t len, uint32_t *offs);
+
+//usernames seen during ingest, shared by every stage; transactions only carry their ids
+extern intern_table_t usernames;
+
+//returns n bytes from the arena, 16 byte aligned; NULL if a new block could not be allocated
+void *arena_alloc(arena_t *arena, size_t n);
+
+//releases every allocation made from the arena in one shot
+void arena_release(arena_t *arena);
+
+//FNV-1a hash of a username
+uint64_t hash_name(const char *name, size_t len);
+
+//returns the id of name[0, len), adding it to the table if it is new
+//names are truncated to USERNAME_LEN - 1 characters, same as the old fixed size fields
+uint32_t intern_name(intern_table_t *table, const char *name, size_t len);
+
+//returns the id of a null terminated username, or UINT32_MAX if it was never interned
+uint32_t find_name(const intern_table_t *table, const char *name);
+
+//frees the table's memory
+void free_names(intern_table_t *table);
+
+//frees the columns
+void free_ledger(ledger_t *ledger);
+
+//allocates the columns for length rows, zeroed; returns 4 if out of memory
+int alloc_ledger(ledger_t *ledger, int length);
+
+//parses a decimal number starting at p, stops at the first non digit or at end (same as atoi)
+int64_t parse_number(const char *p, const char *end);
+
+//fills row of the ledger from one CSV line [line, end) given the positions of its first ncomma commas
+//usernames are interned into table; missing fields are empty, same as the fgets reader
+void fill_transaction(ledger_t *ledger, int row, intern_table_t *table, const char *line, const char **commas, int ncomma, const char *end);
+
+//parses one CSV line [line, end) into row of the ledger
+void parse_transaction(const char *line, const char *end, intern_table_t *table, ledger_t *ledger, int row);
+
+//picks the widest tokenizer the CPU supports
+scan_delims_fn select_scan_delims(void);
+
+//copies the columns of a mapped binary ledger into the ledger; no text is parsed
+//the dictionary is interned once and the id columns are remapped to it; row 0 is left zeroed in place of the CSV header row
+int load_ledger(const char *map, size_t size, ledger_t *ledger);
+
+//memory maps the CSV (or binary ledger) and parses it into the ledger's columns with up to threads threads, each one owning a newline aligned byte range
+//every range interns its usernames privately; the tables are merged in file order afterwards so ids match a serial read
+//returns 0 on success, 1 on bad arguments, 2 if the file can't be opened, 3 if it can't be mapped, 4 if out of memory, 5 for a corrupt binary ledger
+int read_transactions(const char *filename, ledger_t *ledger, int threads);
+
+//checks whether the filename argument selects streaming from stdin
+int is_stream(const char *name);
+
+//reads up to STREAM_BATCH lines from in into rows 1.. of batch; row 0 stands in for the header row like in read_transactions
+//with hold_partial, a last line without its '\n' is pushed back for a later read instead of parsed
+//returns the batch length including that row, so 1 means the input is exhausted
+int read_batch(FILE *in, ledger_t *batch, int hold_partial);
+
+//sorts rows [first, length) of the ledger by time in place with up to threads threads; equal times stay in file order
+//the sort runs on a permutation of keys and each column is then gathered into the new order in its own pass
+int sort_ledger(ledger_t *ledger, int first, int threads);
+
+//allocates view and fills it with the rows of ledger sorted by time, leaving ledger untouched for stages that read it in file order
+int sorted_view(const ledger_t *ledger, ledger_t *view, int threads);
+
+#endif
@@ -1,284 +1,270 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
-#include <stdint.h>
-#include <string.h>
-
-#define USERNAME_LEN 80
-
-/**
- * @brief Represents a transaction.
- * 
- * @param created_at The datetime at which the user created this transaction.
- * @param sender The sender's username.
- * @param recipient The recipient's username.
- * @param amount The amount transferred from sender to recipient.
- */
-typedef struct transaction_t {
-    time_t created_at;
-    char sender[USERNAME_LEN];
-    char recipient[USERNAME_LEN];
-    uint64_t amount;
-} transaction_t;
-
-/**
- * @brief Represents an account balance.
- * 
- * @param username The account holder's username.
- * @param amount The account balance.
- */
-typedef struct balance_t {
-    char username[USERNAME_LEN];
-    uint64_t amount;
-} balance_t;
-
-//assume each line in the CSV is fewer than 256 characters
-
-int read_transactions(char *filename, transaction_t **arr, int *length) {
-    // check for bad inputs.
-    if (!filename || !arr || !length){return 1;}
-    
-    // open file:
-    FILE *file = fopen(filename, "r");
-
-    //check if there was an error opening the file (file would be NULL).
-    if (!file){return 2;}
-
-    //count the number of lines:
-    int num_lines = 0;
-    char line[256] = {0};
-    while (NULL != fgets(line, sizeof(line), file)) {
-        num_lines ++;
+#include <limits.h>
+#include "../common/ledger.h"
+#include "../common/balances.h"
+
+//number of threads the parse and the sort may use
+int nthreads = 1;
+//times picked with --as-of, one balance table is printed for each
+time_t *as_of = NULL;
+int num_as_of = 0;
+//transactions between balance snapshots, and whether --snapshot-every picked it
+int snapshot_interval = BALANCE_SNAPSHOT_INTERVAL;
+int snapshot_interval_set = 0;
+//snapshot file picked with --snapshots, NULL for the ledger's name followed by .snap
+char *snapshot_path = NULL;
+
+//takes the --name value options out of argv so help only sees the positional arguments
+//returns the new argc, or 0 if an option has a bad value
+int parse_options(int argc, char *argv[]){
+    int i, kept = 1, ok = 1;
+    const char *value;
+    char *end;
+    as_of = malloc(argc * sizeof(time_t));
+    if (!as_of){return 0;}
+    for (i=1; i < argc; i++){
+        value = NULL;
+        if (!strcmp(argv[i], "--as-of") && i + 1 < argc){
+            value = argv[++i];
+        }
+        else if (!strncmp(argv[i], "--as-of=", 8)){
+            value = argv[i] + 8;
+        }
+        else if (!strcmp(argv[i], "--snapshot-every") && i + 1 < argc){
+            snapshot_interval = strtol(argv[++i], &end, 10);
+            snapshot_interval_set = 1;
+            ok = ok && !*end && snapshot_interval > 0;
+        }
+        else if (!strncmp(argv[i], "--snapshot-every=", 17)){
+            snapshot_interval = strtol(argv[i] + 17, &end, 10);
+            snapshot_interval_set = 1;
+            ok = ok && !*end && snapshot_interval > 0;
+        }
+        else if (!strcmp(argv[i], "--snapshots") && i + 1 < argc){
+            snapshot_path = argv[++i];
+        }
+        else if (!strncmp(argv[i], "--snapshots=", 12)){
+            snapshot_path = argv[i] + 12;
+        }
+        else {
+            argv[kept++] = argv[i];
+        }
+        if (value){
+            as_of[num_as_of++] = strtoll(value, &end, 10);
+            ok = ok && *value && !*end;
+        }
     }
+    if (!ok){
+        printf("\n--as-of takes a created_at time and --snapshot-every a positive number of transactions\n\n");
+    }
+    argv[kept] = NULL;
+    return ok ? kept : 0;
+}
 
-    //go back to the beginning of the file:
-    rewind(file);
-
-    //create the result array and set the length:
-    *arr = calloc(num_lines, sizeof(transaction_t));
-    *length = num_lines;
-
-    //fill the result array:
-    //Need to convert each line to the transaction fields in transaction_t
-
-    int idx = 0, created = 0, money = 0, i = 0, slen = 0;
-    char sendr[USERNAME_LEN] = {0};
-    char recvr[USERNAME_LEN] = {0};
-
-    while (NULL != fgets(line, sizeof(line), file)) {
+//prints the balances of state as of the time, names giving every username id
+void print_as_of(time_t time, const balance_state_t *state, const char (*names)[USERNAME_LEN]){
+    int i;
+    printf("as_of,%ld\n", time);
+    printf("username,balance\n");
+    for (i=0; i < state->dictlength; i++){
+        printf("%s,%lu\n", names[state->dict[i].user_id], state->dict[i].amount);
+    }
+}
 
-        //Reset variables for each line
-        created = 0;
-        money = 0;
-        i = 0;
-        slen = 0;
+//returns the first row of the time sorted ledger created after time, so rows [1, that row) are the ledger cut at time
+int rows_until(const ledger_t *sorted, time_t time){
+    int lo = 1, hi = sorted->length, mid;
+    while (lo < hi){
+        mid = lo + (hi - lo) / 2;
+        if (sorted->created_at[mid] <= time){lo = mid + 1;}
+        else {hi = mid;}
+    }
+    return lo;
+}
 
-        //setting created (time) field
-        created += atoi(&line[i]);
+//prints the balances of each --as-of time from the ledger's snapshot file, writing it first if it is missing or stale
+//once it is written, a run only maps it: no parse and no sort, one snapshot and at most an interval of rows per time
+int answer_as_of(const char *filename){
+    balance_snapshots_t snaps;
+    balance_state_t state;
+    ledger_t ledger = {0};
+    char path[PATH_MAX];
+    int i, status;
+
+    if (snapshot_path){
+        snprintf(path, sizeof(path), "%s", snapshot_path);
+    }
+    else {
+        snprintf(path, sizeof(path), "%s.snap", filename);
+    }
 
-        //move i to end of field, which is the ','
-        for (; i < 256; i++){
-            if (line[i] == ','){break;}
+    //an explicit --snapshot-every rewrites snapshots taken with another interval
+    if (open_balance_snapshots(path, filename, snapshot_interval_set ? snapshot_interval : 0, &snaps)){
+        //missing or stale: the ledger is parsed and sorted once, and the snapshots kept for the next run
+        status = read_transactions(filename, &ledger, nthreads);
+        if (status){
+            fprintf(stderr, "Could not read %s (error %d)\n", filename, status);
+            free_ledger(&ledger);
+            return status;
         }
-
-        //incrementing i to first index of the sender field
-        i++;
-
-        //i is now index of the first ','; now set the sender field; slen is used as index and length (at the end)
-        for (; i < 256; i++){
-            if (line[i] == ','){break;}
-            sendr[slen] = (char)(line[i]);
-            slen++;
+        sort_ledger(&ledger, 1, nthreads);
+        if (write_balance_snapshots(path, filename, &ledger, snapshot_interval) || open_balance_snapshots(path, filename, 0, &snaps)){
+            //the snapshots can't be kept: each time is answered by replaying the sorted rows up to it
+            fprintf(stderr, "Could not write balance snapshots %s, replaying the ledger for every time\n", path);
+            for (i=0; i < num_as_of; i++){
+                ledger_t prefix = ledger;
+                prefix.length = rows_until(&ledger, as_of[i]);
+                memset(&state, 0, sizeof(state));
+                if (!update_balances(&state, &prefix, 1)){
+                    print_as_of(as_of[i], &state, (const char (*)[USERNAME_LEN])usernames.names);
+                }
+                free_balances(&state);
+            }
+            free_ledger(&ledger);
+            return 0;
         }
+        free_ledger(&ledger);
+    }
 
-        //setting last null char for sendr
-        sendr[slen] = '\0';
-
-        //Setting sender using the length calculated above
-        strncpy(((*arr)[idx]).sender, sendr, slen);
-
-        //resetting slen for second string; receiver
-        slen = 0;
-
-        //incrementing i; is now at first index of the receiver field
-        i++;
-
-        //moving each character into the local recvr string
-        for (; i < 256; i++){
-            if (line[i] == ','){break;}
-            recvr[slen] = (char)(line[i]);
-            slen++;
+    for (i=0; i < num_as_of; i++){
+        memset(&state, 0, sizeof(state));
+        if (!snapshot_balances_as_of(&snaps, as_of[i], &state)){
+            print_as_of(as_of[i], &state, snaps.names);
         }
-
-        //setting last null char for recvr
-        recvr[slen] = '\0';
-
-        //incrementing i, is now at the first index of the last csv field
-        i++;
-
-        //Setting money (amount)
-        money += atoi(&line[i]);
-
-        //Setting all remaining fields of the transaction_t equal to local variables; sender was set above
-        ((*arr)[idx]).created_at = (time_t)created;
-        //setting recipient using the slen calculated above
-        strncpy(((*arr)[idx]).recipient, recvr, slen);
-        ((*arr)[idx]).amount = (uint64_t)money;
-        //incrementing index for the array as we are moving to a new line in the csv
-        idx++;
+        free_balances(&state);
     }
-
-    // Closing the file
-    fclose(file);
-
+    close_balance_snapshots(&snaps);
     return 0;
 }
 
-int compare_times(const void *a, const void *b) {
-    time_t *x = (time_t *)a;
-    time_t *y = (time_t *)b;
-    return *x - *y;
-}
-
-int calculate_balances(balance_t **dict, transaction_t **arr, int arrlen, int *dictlength){
-    int i, j, k, dictlen = 0;
-    char* user;
-
-    //setting dictionary variable and allocating memory
-    *dict = calloc((2 * arrlen), sizeof(balance_t));
-
-    //loop through array of transactions to initialize balances to 0
-    for (i=1; i < arrlen; i++){
-        user = (*arr)[i].sender;
-        for (j=0; j <= dictlen; j++){
-                //check to see if the sender is system; don't track system balance
-                if (!(strcmp(user, "system"))){
-                    break;
-                }
-                //if end of dictionary is reached and account is not found, add account to dictionary
-                //after adding account increment dictionary length
-                else if (j == dictlen){
-                    strncpy((*dict)[j].username, user, strnlen(user, 100)); 
-                    (*dict)[j].amount = 0;
-                    dictlen ++;
-                    break;
-                }
-                //if recipient account is found, break
-                else if (!(strcmp((*dict)[j].username, user))){
-                    break;
-                }
-            }
-        user = (*arr)[i].recipient;
-        for (j=0; j <= dictlen; j++){
-                //if end of dictionary is reached and account is not found, add account to dictionary
-                //after adding account increment dictionary length
-                if (j == dictlen){
-                    strncpy((*dict)[j].username, user, strnlen(user, 100)); 
-                    (*dict)[j].amount = 0;
-                    dictlen ++;
-                    break;
-                }
-                //if recipient account is found, break
-                else if (!(strcmp((*dict)[j].username, user))){
-                    break;
-                }
-            }
+//streaming mode: reads transactions from in one bounded batch at a time
+//each batch is sorted, printed and folded into the balances, so memory only grows with the number of accounts
+int stream_balances(FILE *in){
+    ledger_t batch;
+    balance_state_t balances = {0};
+    int i, status = 0;
+    char header[256];
+
+    if (alloc_ledger(&batch, STREAM_BATCH + 1)){
+        fprintf(stderr, "Out of memory reading the stream\n");
+        return 4;
     }
 
-    //looping through the array of transactions again to calculate balances
-    for (i=1; i < arrlen; i++){
-        //if the sender is system: add balance to recipient account
-        if (!(strcmp((*arr)[i].sender, "system"))){
-            //loop through dictionary to find recipient account
-            for (j=0; j < dictlen; j++){
-                //when recipient account is found, add amount to the account
-                if (!(strcmp((*dict)[j].username, (*arr)[i].recipient))){
-                    (*dict)[j].amount += (*arr)[i].amount;
-                    break;
-                }
+    //skipping the CSV header
+    if (NULL != fgets(header, sizeof(header), in)){
+        printf("created_at,sender,recipient,amount\n");
+        while (!status && read_batch(in, &batch, 0) > 1){
+            //sorting within the batch; the stream itself is expected in time order
+            if (sort_ledger(&batch, 1, nthreads) || update_balances(&balances, &batch, 1)){
+                fprintf(stderr, "Out of memory reading the stream\n");
+                status = 4;
+                break;
             }
-        }
-        //if sender is not system: check that transaction is valid and execute transaction
-        else {
-            //loop through dictionary to find sender
-            for (j=0; j < dictlen; j++){
-                //if sender is found, check that balance is greater than transaction amount
-                if (!(strcmp((*dict)[j].username, (*arr)[i].sender))){
-                    if ((*dict)[j].amount >= (*arr)[i].amount){
-                        //if valid, subtract amount from sender account
-                        (*dict)[j].amount -= (*arr)[i].amount;
-                        //loop through dictionary again to find recipient account
-                        for(k=0; k < dictlen; k++){
-                            if (!(strcmp((*dict)[k].username, (*arr)[i].recipient))){
-                                //if recipient account is found, add amount to recipient
-                                (*dict)[k].amount += (*arr)[i].amount;
-                                break;
-                            }
-                        }
-                    }
-                    //break if sender is found
-                    break;
-                }
+            for (i=1; i < batch.length; i++){
+                printf("%ld,%s,%s,%lu\n", batch.created_at[i], usernames.names[batch.sender_id[i]], usernames.names[batch.recipient_id[i]], batch.amount[i]);
             }
+            //handing the batch to the reader right away
+            fflush(stdout);
+        }
+        //printing final account balances
+        printf("username,balance\n");
+        for (i=0; i < balances.dictlength; i++){
+            printf("%s,%lu\n", usernames.names[balances.dict[i].user_id], balances.dict[i].amount);
         }
     }
 
-    //set dictlength input parameter
-    *dictlength = dictlen;
-    //return
-    return 0;
+    free_balances(&balances);
+    free_ledger(&batch);
+    free_names(&usernames);
+    return status;
 }
 
 //checks for correct usage
 int help(int argc, char *argv[]){
     if (argc == 1){
-        printf("\nUsage: pr1 filename\n\nEnter pr1 -h for usage examples\n\n");
+        printf("\nUsage: pr1 filename [numthreads]\n\nEnter pr1 -h for usage examples\n\n");
         return 0;
     }
-    else if (argc > 2){
-        printf("\nTakes one argument. (%d) arguments were given\n\nUsage: pr1 filename\n\nEnter pr1 -h for usage examples\n\n", (argc - 1));
+    else if (argc > 3){
+        printf("\nTakes at most two arguments. (%d) arguments were given\n\nUsage: pr1 filename [numthreads]\n\nEnter pr1 -h for usage examples\n\n", (argc - 1));
         return 0;
     }
     else if ((!(strcmp(argv[1], "-h"))) || (!(strcmp(argv[1], "--help")))){
         printf("\npr1: Takes a CSV file as input and prints a list of sorted transactions and ending account balances.\n\n");
         printf("CSV file must be in the format: created_at,sender,recipient,amount.\n\n");
-        printf("Usage: pr1 [filename]. Replace [filename] with the name of the CSV file.\n\n");
+        printf("Usage: pr1 [filename] [numthreads]. Replace [filename] with the name of the CSV file and [numthreads] with the number of threads to sort with (default 1).\n\n");
+        printf("Use - or --stream as the filename to read transactions from stdin in batches.\n\n");
+        printf("Use --as-of [time] (repeatable) to print the balances after the transactions created at or before time instead of the sorted transactions, as if the CSV stopped there. ");
+        printf("The first such run writes the sorted ledger and its balances every --snapshot-every [n] transactions (default %d) to a snapshot file, [filename].snap or the one picked with --snapshots [file]; ", BALANCE_SNAPSHOT_INTERVAL);
+        printf("later runs on the unchanged ledger only read the nearest snapshot and replay the transactions after it.\n\n");
         return 0;
     }
     return 1;
 }
 
-//main is called with one argument: CSV filename
+//main is called with one or two arguments: CSV filename, optional num threads
 int main(int argc, char *argv[]) {
-    //initializing array of transaction_t structs
-    transaction_t *arr = NULL;
-    //initializing dictionary (array) of blance_t structs
-    balance_t *dict = NULL;
-    //initializing array length and dictionary length
-    int arrlength = 0, dictlength = 0, i;
-    //calling help to ensure correct usage
-    if (help(argc, argv)){
-        //calling read_transactions passing in the initialized variables and the name of the CSV file
-        read_transactions(argv[1], &arr, &arrlength);
-        //sorting the transactions based on time, using the compare_times function and qsort
-        qsort(arr, arrlength, sizeof(transaction_t), compare_times);
-        //calculating balances based on trancactions array from above. dictlength and dict of balances will be set after calling
-        calculate_balances(&dict, &arr, arrlength, &dictlength);
-        //printing sorted transactions
-        printf("created_at,sender,recipient,amount\n");
-        for (i=1; i < arrlength; i++){
-            printf("%ld,%s,%s,%lu\n", arr[i].created_at, arr[i].sender, arr[i].recipient, arr[i].amount);
+    //initializing the columns of transactions
+    ledger_t ledger = {0};
+    //initializing the balances and the index into them
+    balance_state_t balances = {0};
+    //initializing counter variable, and the exit status
+    int i, status = 0;
+    //options come out of argv first (argc is 0 if one has a bad value), then help ensures correct usage
+    argc = parse_options(argc, argv);
+    int usage_ok = argc && help(argc, argv);
+    //set number of threads (at least one)
+    if (usage_ok && argc > 2){
+        nthreads = strtol(argv[2], NULL, 10);
+        if (nthreads < 1){
+            nthreads = 1;
         }
-        //printing final account balances
-        printf("username,balance\n");
-        for (i=0; i < dictlength; i++){
-            printf("%s,%lu\n", dict[i].username, dict[i].amount);
+    }
+    if (usage_ok && num_as_of && is_stream(argv[1])){
+        //a stream is only sorted batch by batch, so there is nothing to snapshot
+        printf("\n--as-of needs a file\n\n");
+        status = 1;
+    }
+    else if (usage_ok && is_stream(argv[1])){
+        //reading transactions from stdin batch by batch
+        status = stream_balances(stdin);
+    }
+    else if (usage_ok && num_as_of){
+        //answering each time from the ledger's balance snapshots
+        status = answer_as_of(argv[1]);
+    }
+    else if (usage_ok){
+        //calling read_transactions passing in the initialized ledger and the name of the CSV file
+        status = read_transactions(argv[1], &ledger, nthreads);
+        if (status){
+            fprintf(stderr, "Could not read %s (error %d)\n", argv[1], status);
+        }
+        //sorting the transactions (after the header row) based on time
+        //then calculating balances based on trancactions from above
+        else if (sort_ledger(&ledger, 1, nthreads) || calculate_balances(&balances, &ledger)){
+            fprintf(stderr, "Out of memory sorting %s\n", argv[1]);
+            status = 4;
+        }
+        else {
+            //printing sorted transactions
+            printf("created_at,sender,recipient,amount\n");
+            for (i=1; i < ledger.length; i++){
+                printf("%ld,%s,%s,%lu\n", ledger.created_at[i], usernames.names[ledger.sender_id[i]], usernames.names[ledger.recipient_id[i]], ledger.amount[i]);
+            }
+            //printing final account balances
+            printf("username,balance\n");
+            for (i=0; i < balances.dictlength; i++){
+                printf("%s,%lu\n", usernames.names[balances.dict[i].user_id], balances.dict[i].amount);
+            }
         }
     }
-    //freeing memory used for dict and arr
-    free(dict);
-    free(arr);
+    //freeing memory used for the balances, their index, the ledger and the usernames
+    free_balances(&balances);
+    free(as_of);
+    free_ledger(&ledger);
+    free_names(&usernames);
     //return
-    return 0;
+    return status;
 }
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "sha256.h"
+#include "miner.h"
+
+//synthetic workload: BENCH_BLOCKS made up transactions mined at BENCH_DIFFICULTY_BITS
+#define BENCH_BLOCKS 64
+#define BENCH_DIFFICULTY_BITS 20
+//sum of the lowest valid nonces of the workload; any backend or thread count that disagrees is broken
+#define BENCH_NONCE_SUM 63476235ULL
+//nonces hashed per raw hash rate run, chosen so that no nonce in the range hits the all ones mask
+#define BENCH_HASHES (1 << 22)
+
+//midstates of the workload's blocks
+sha256_midstate_t mids[BENCH_BLOCKS];
+//nonce found for each block by the current run
+uint64_t nonces[BENCH_BLOCKS];
+//next block for a thread to claim
+atomic_int next_block = 0;
+//search used by the mining threads
+sha256_search_fn bench_search = NULL;
+
+double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int compare_doubles(const void *a, const void *b){
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+//median of the n runs (sorts them)
+double median(double *runs, int n){
+    qsort(runs, n, sizeof(double), compare_doubles);
+    return (n % 2) ? runs[n / 2] : (runs[n / 2 - 1] + runs[n / 2]) / 2;
+}
+
+//builds the fixed synthetic blocks and their midstates, laid out as the miners hash them
+void build_workload(void){
+    block_t block;
+    int i;
+    for (i=0; i < BENCH_BLOCKS; i++){
+        memset(&block, 0, sizeof(block));
+        block.transaction.created_at = 1700000000 + i;
+        snprintf(block.transaction.sender, BLOCK_NAME_LEN, "bench_sender_%d", i);
+        snprintf(block.transaction.recipient, BLOCK_NAME_LEN, "bench_recipient_%d", i % 7);
+        block.transaction.amount = i + 1;
+        sha256_midstate_init(&mids[i], &block, sizeof(block), offsetof(block_t, proof_of_work));
+    }
+}
+
+//mines blocks claimed from the shared cursor, like mine_blocks in pr4_p
+void *mine_workload(void *unused){
+    int k;
+    while ((k = atomic_fetch_add(&next_block, 1)) < BENCH_BLOCKS){
+        if (!bench_search(&mids[k], 0, UINT64_MAX, SHA256_DIFFICULTY_MASK(BENCH_DIFFICULTY_BITS), &nonces[k])){
+            nonces[k] = 0;
+        }
+    }
+    return NULL;
+}
+
+//mines the whole workload with threads threads; returns the wall time and sets *ok if every nonce is the known one
+double run_workload(pthread_t *thread_array, int threads, int *ok){
+    uint64_t sum = 0;
+    int i;
+    double start = now();
+    atomic_store(&next_block, 0);
+    for (i=0; i < threads; i++){
+        pthread_create(&thread_array[i], NULL, mine_workload, NULL);
+    }
+    for (i=0; i < threads; i++){
+        pthread_join(thread_array[i], NULL);
+    }
+    double elapsed = now() - start;
+    for (i=0; i < BENCH_BLOCKS; i++){
+        sum += nonces[i];
+    }
+    *ok = *ok && sum == BENCH_NONCE_SUM;
+    return elapsed;
+}
+
+//checks for correct usage
+int help(int argc, char *argv[]){
+    if (argc > 3 || (argc > 1 && (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")))){
+        printf("\nbench: Measures raw hashes/sec of every hash backend and blocks/sec of a synthetic workload at 1..maxthreads threads, printed as JSON.\n\n");
+        printf("Usage: bench [maxthreads] [repeats]. Defaults: 4 threads, 3 repeats after one warmup run.\n\n");
+        return 0;
+    }
+    return 1;
+}
+
+//main is called with up to two arguments: max threads, repeats
+int main(int argc, char *argv[]) {
+    int max_threads = 4, repeats = 3, ok = 1, i, r, t, first = 1;
+    const char *name, *scaling_backend;
+    uint64_t nonce;
+
+    if (!help(argc, argv)){
+        return 1;
+    }
+    if (argc > 1){
+        max_threads = strtol(argv[1], NULL, 10);
+    }
+    if (argc > 2){
+        repeats = strtol(argv[2], NULL, 10);
+    }
+    if (max_threads < 1){max_threads = 1;}
+    if (repeats < 1){repeats = 1;}
+
+    double *runs = malloc(repeats * sizeof(double));
+    double *blocks_per_sec = malloc(max_threads * sizeof(double));
+    pthread_t *thread_array = malloc(max_threads * sizeof(pthread_t));
+    if (!runs || !blocks_per_sec || !thread_array){
+        return 4;
+    }
+    build_workload();
+
+    printf("{\n  \"workload\": {\"blocks\": %d, \"difficulty_bits\": %d, \"nonce_sum\": %llu, \"repeats\": %d},\n",
+           BENCH_BLOCKS, BENCH_DIFFICULTY_BITS, (unsigned long long)BENCH_NONCE_SUM, repeats);
+
+    //raw hash rate of every backend this CPU runs: one warmup, then the median of the repeats
+    printf("  \"backends\": [");
+    for (i=0; (name = sha256_backend_name(i)); i++){
+        sha256_search_fn search = sha256_select_search(name, NULL);
+        if (!search){continue;}
+        search(&mids[0], 0, BENCH_HASHES, 0xffffffffu, &nonce);
+        for (r=0; r < repeats; r++){
+            double start = now();
+            search(&mids[0], 0, BENCH_HASHES, 0xffffffffu, &nonce);
+            runs[r] = BENCH_HASHES / (now() - start);
+        }
+        //the workload must come out the same with every backend
+        int backend_ok = 1;
+        bench_search = search;
+        run_workload(thread_array, 1, &backend_ok);
+        ok = ok && backend_ok;
+        printf("%s\n    {\"name\": \"%s\", \"hashes_per_sec\": %.0f, \"nonces_ok\": %s}", first ? "" : ",", name, median(runs, repeats), backend_ok ? "true" : "false");
+        first = 0;
+    }
+    printf("\n  ],\n");
+
+    //blocks/sec of the preferred backend at 1..max_threads threads
+    bench_search = sha256_select_search(NULL, &scaling_backend);
+    printf("  \"scaling\": {\"backend\": \"%s\", \"results\": [", scaling_backend);
+    for (t=1; t <= max_threads; t++){
+        run_workload(thread_array, t, &ok);
+        for (r=0; r < repeats; r++){
+            runs[r] = BENCH_BLOCKS / run_workload(thread_array, t, &ok);
+        }
+        blocks_per_sec[t - 1] = median(runs, repeats);
+        printf("%s\n    {\"threads\": %d, \"blocks_per_sec\": %.2f, \"speedup\": %.2f, \"efficiency\": %.2f}",
+               t > 1 ? "," : "", t, blocks_per_sec[t - 1], blocks_per_sec[t - 1] / blocks_per_sec[0],
+               blocks_per_sec[t - 1] / blocks_per_sec[0] / t);
+    }
+    printf("\n  ]},\n  \"nonces_ok\": %s\n}\n", ok ? "true" : "false");
+
+    free(runs);
+    free(blocks_per_sec);
+    free(thread_array);
+    //a wrong nonce anywhere fails the run
+    return ok ? 0 : 1;
+}
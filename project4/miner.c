@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <limits.h>
+#include "miner.h"
+
+sha256_search_fn search_nonces = sha256_search_scalar;
+uint32_t target_mask = SHA256_DIFFICULTY_MASK(DEFAULT_DIFFICULTY_BITS);
+char *checkpoint_path = NULL;
+char *hash_backend = NULL;
+uint64_t checkpoint_rows = 0;
+
+void build_block(block_t *block, const ledger_t *ledger, int row) {
+    const char *sender = usernames.names[ledger->sender_id[row]];
+    const char *recipient = usernames.names[ledger->recipient_id[row]];
+    memset(block, 0, sizeof(block_t));
+    block->transaction.created_at = ledger->created_at[row];
+    memcpy(block->transaction.sender, sender, strnlen(sender, BLOCK_NAME_LEN - 1));
+    memcpy(block->transaction.recipient, recipient, strnlen(recipient, BLOCK_NAME_LEN - 1));
+    block->transaction.amount = ledger->amount[row];
+}
+
+int set_difficulty(const char *value){
+    char *end;
+    long bits = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || bits < 1 || bits > MAX_DIFFICULTY_BITS){
+        printf("\nDifficulty must be a number of bits from 1 to %d. (%s) was given\n\n", MAX_DIFFICULTY_BITS, value);
+        return 0;
+    }
+    target_mask = SHA256_DIFFICULTY_MASK(bits);
+    return 1;
+}
+
+int parse_options(int argc, char *argv[], option_fn extra){
+    int i, kept = 1, ok = 1;
+    for (i=1; i < argc; i++){
+        if (!strcmp(argv[i], "--hash-backend") && i + 1 < argc){
+            hash_backend = argv[++i];
+        }
+        else if (!strncmp(argv[i], "--hash-backend=", 15)){
+            hash_backend = argv[i] + 15;
+        }
+        else if (!strcmp(argv[i], "--checkpoint") && i + 1 < argc){
+            checkpoint_path = argv[++i];
+        }
+        else if (!strncmp(argv[i], "--checkpoint=", 13)){
+            checkpoint_path = argv[i] + 13;
+        }
+        else if (!strcmp(argv[i], "--difficulty-bits") && i + 1 < argc){
+            ok = set_difficulty(argv[++i]) && ok;
+        }
+        else if (!strncmp(argv[i], "--difficulty-bits=", 18)){
+            ok = set_difficulty(argv[i] + 18) && ok;
+        }
+        else if (!extra || !extra(argc, argv, &i, &ok)){
+            argv[kept++] = argv[i];
+        }
+    }
+    argv[kept] = NULL;
+    return ok ? kept : 0;
+}
+
+int select_backend(void){
+    search_nonces = sha256_select_search(hash_backend, NULL);
+    if (!search_nonces){
+        printf("\nUnknown or unsupported hash backend: %s\n\nBackends: ", hash_backend);
+        sha256_print_backends(stdout);
+        printf("\n\n");
+        return 0;
+    }
+    return 1;
+}
+
+uint64_t checkpoint_fingerprint(FILE *in, uint64_t offset) {
+    unsigned char buf[CHECKPOINT_FINGERPRINT_BYTES];
+    uint64_t hash = 14695981039346656037ULL, n = offset < sizeof(buf) ? offset : sizeof(buf), i;
+    if (fseek(in, (long)(offset - n), SEEK_SET) || fread(buf, 1, n, in) != n){return 0;}
+    for (i=0; i < n; i++){
+        hash = (hash ^ buf[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+int load_checkpoint(FILE *in, restore_credit_fn restore) {
+    checkpoint_header_t header;
+    checkpoint_credit_t credit;
+    char name[USERNAME_LEN];
+    uint64_t i;
+    int status = 0;
+    FILE *ckpt = fopen(checkpoint_path, "rb");
+
+    if (!ckpt){return 1;}
+    if (fread(&header, sizeof(header), 1, ckpt) != 1 || memcmp(header.magic, CHECKPOINT_MAGIC, 8) || header.version != CHECKPOINT_VERSION
+        || checkpoint_fingerprint(in, header.offset) != header.fingerprint){
+        fclose(ckpt);
+        return -1;
+    }
+    //recipients go back in the order they were first credited
+    for (i=0; i < header.num_credits && !status; i++){
+        if (fread(&credit, sizeof(credit), 1, ckpt) != 1 || credit.name_len >= USERNAME_LEN
+            || fread(name, 1, credit.name_len, ckpt) != credit.name_len){
+            status = -1;
+            break;
+        }
+        if (restore(intern_name(&usernames, name, credit.name_len), credit.pending_credit, i)){
+            status = -1;
+        }
+    }
+    fclose(ckpt);
+    checkpoint_rows = header.rows;
+    if (status || fseek(in, (long)header.offset, SEEK_SET)){return -1;}
+    return 0;
+}
+
+int save_checkpoint(FILE *in, const credit_entry_t *entries, uint64_t n) {
+    checkpoint_header_t header;
+    checkpoint_credit_t credit;
+    char tmp_path[PATH_MAX];
+    uint64_t i;
+    long offset = ftell(in);
+
+    if (offset < 0){return 1;}
+    memcpy(header.magic, CHECKPOINT_MAGIC, 8);
+    header.version = CHECKPOINT_VERSION;
+    header.offset = (uint64_t)offset;
+    header.rows = checkpoint_rows;
+    header.fingerprint = checkpoint_fingerprint(in, header.offset);
+    header.num_credits = n;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", checkpoint_path);
+    FILE *ckpt = fopen(tmp_path, "wb");
+    if (!ckpt){return 1;}
+    int status = fwrite(&header, sizeof(header), 1, ckpt) != 1;
+    for (i=0; i < n && !status; i++) {
+        const char *name = usernames.names[entries[i].recipient_id];
+        credit.pending_credit = entries[i].pending_credit;
+        credit.name_len = strnlen(name, USERNAME_LEN - 1);
+        status = fwrite(&credit, sizeof(credit), 1, ckpt) != 1
+                 || fwrite(name, 1, credit.name_len, ckpt) != credit.name_len;
+    }
+    status = fclose(ckpt) || status;
+    if (status || rename(tmp_path, checkpoint_path)){
+        unlink(tmp_path);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+#ifndef MINER_H
+#define MINER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "../common/ledger.h"
+#include "sha256.h"
+
+//usernames take this many bytes inside a block, terminator included; longer names are cut when the block is built
+#define BLOCK_NAME_LEN 64
+#define SHA256_DIGEST_LENGTH 32
+//a block is mined when its digest starts with this many zero bits; by default the first three bytes
+#define DEFAULT_DIFFICULTY_BITS 24
+//the target is tested on the first digest word only, a single masked compare per nonce
+#define MAX_DIFFICULTY_BITS 32
+
+//magic bytes at the start of a checkpoint file
+#define CHECKPOINT_MAGIC "TXCHKPNT"
+//checkpoint format version this program reads
+#define CHECKPOINT_VERSION 1
+//bytes before the checkpoint offset that must be unchanged for the checkpoint to apply
+#define CHECKPOINT_FINGERPRINT_BYTES 4096
+
+/**
+ * @brief Represents a transaction as it is hashed inside a block, with the usernames spelled out.
+ *
+ * @param created_at The datetime at which the user created this transaction.
+ * @param sender The sender's username, zero padded.
+ * @param recipient The recipient's username, zero padded.
+ * @param amount The amount transferred from sender to recipient.
+ */
+typedef struct block_transaction_t {
+    time_t created_at;
+    char sender[BLOCK_NAME_LEN];
+    char recipient[BLOCK_NAME_LEN];
+    uint64_t amount;
+} block_transaction_t;
+
+/**
+ * @brief Represents a block in the blockchain.
+ *
+ * @param transaction The transaction this block contains.
+ * @param proof_of_work A number such that the hash of the block_t contains
+ * some number of leading zeros. It has no meaning other than as part of the
+ * hash.
+ */
+typedef struct block_t {
+    block_transaction_t transaction;
+    uint64_t proof_of_work;
+} block_t;
+
+/**
+ * @brief Represents the header of a checkpoint file, followed by num_credits pending credit records.
+ *
+ * @param magic CHECKPOINT_MAGIC.
+ * @param version CHECKPOINT_VERSION.
+ * @param offset Byte offset in the CSV just past the last line processed.
+ * @param rows Number of transactions processed so far.
+ * @param fingerprint FNV-1a hash of the CHECKPOINT_FINGERPRINT_BYTES before offset, to notice a rewritten CSV.
+ * @param num_credits Number of recipients in the pending credit table.
+ */
+typedef struct checkpoint_header_t {
+    char magic[8];
+    uint64_t version;
+    uint64_t offset;
+    uint64_t rows;
+    uint64_t fingerprint;
+    uint64_t num_credits;
+} checkpoint_header_t;
+
+/**
+ * @brief Represents one recipient of the pending credit table in a checkpoint file, followed by the username's bytes.
+ *
+ * @param pending_credit amount of pending credit.
+ * @param name_len Length of the username.
+ */
+typedef struct checkpoint_credit_t {
+    uint64_t pending_credit;
+    uint64_t name_len;
+} checkpoint_credit_t;
+
+/**
+ * @brief Represents an account copied out of a pending credit table.
+ *
+ * @param recipient_id interned username of user.
+ * @param pending_credit amount of pending credit.
+ * @param first_row position of the first row crediting the user.
+ */
+typedef struct credit_entry_t {
+    uint32_t recipient_id;
+    uint64_t pending_credit;
+    long first_row;
+} credit_entry_t;
+
+//a program's own options: returns 1 if argv[*i] is one, moving *i past its value and clearing *ok if the value is bad
+typedef int (*option_fn)(int argc, char *argv[], int *i, int *ok);
+
+//adds a recipient restored from a checkpoint to the program's pending credit; i is its position in the checkpoint
+//returns nonzero if it could not be added
+typedef int (*restore_credit_fn)(uint32_t recipient, uint64_t pending_credit, uint64_t i);
+
+//nonce search kernel, the widest the CPU supports
+extern sha256_search_fn search_nonces;
+//bits of the first digest word that must be zero, set with --difficulty-bits
+extern uint32_t target_mask;
+//path of the checkpoint picked with --checkpoint, NULL to process the whole CSV every run
+extern char *checkpoint_path;
+//name of the hashing backend picked with --hash-backend, NULL to pick by CPU
+extern char *hash_backend;
+//number of transactions processed, including the runs before the checkpoint
+extern uint64_t checkpoint_rows;
+
+//lays out a row of the ledger in a block exactly as the hashed block_t bytes: usernames cut to BLOCK_NAME_LEN - 1 and zero padded, zeroed padding
+void build_block(block_t *block, const ledger_t *ledger, int row);
+
+//sets the target from a --difficulty-bits value; returns 0 if it isn't a number of bits from 1 to MAX_DIFFICULTY_BITS
+int set_difficulty(const char *value);
+
+//takes the --name value options out of argv so help only sees the positional arguments
+//--hash-backend, --checkpoint and --difficulty-bits are handled here, the rest by extra (if not NULL)
+//returns the new argc, or 0 if an option has a bad value
+int parse_options(int argc, char *argv[], option_fn extra);
+
+//picks the nonce search: the backend named with --hash-backend, or the preferred one this CPU supports
+int select_backend(void);
+
+//FNV-1a over the bytes of in before offset that the checkpoint fingerprints; returns 0 if they can't be read
+uint64_t checkpoint_fingerprint(FILE *in, uint64_t offset);
+
+//restores the pending credit (through restore, in the order it was first credited) and the read position of in from the checkpoint, if there is one yet
+//returns 1 if there is none (in is left at the CSV header), 0 if it was restored, -1 if it doesn't match in
+int load_checkpoint(FILE *in, restore_credit_fn restore);
+
+//writes the read position of in and the n accounts of entries to the checkpoint, through a temporary file renamed over it
+int save_checkpoint(FILE *in, const credit_entry_t *entries, uint64_t n);
+
+#endif
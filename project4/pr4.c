@@ -1,200 +1,79 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #include <stdint.h>
-#include <string.h>
-#include <openssl/sha.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <stddef.h>
+#include "../common/ledger.h"
 #include "uthash.h"
-
-#define USERNAME_LEN 64
-#define SHA256_DIGEST_LENGTH 32
+#include "sha256.h"
+#include "miner.h"
 
 /**
  * @brief Represents a hashtable for storing pending credit.
  * 
- * @param username name of user.
+ * @param recipient_id interned username of user.
  * @param pending_credit amount of pending credit.
  * @param hh makes this structure hashable
  */
 
 typedef struct hashtable_t {                   
-    char username[USERNAME_LEN]; //key
+    uint32_t recipient_id; //key
     uint64_t pending_credit; //value
     UT_hash_handle hh;  
 } hashtable_t;
 
-/**
- * @brief Represents a transaction.
- * 
- * @param created_at The datetime at which the user created this transaction.
- * @param sender The sender's username.
- * @param recipient The recipient's username.
- * @param amount The amount transferred from sender to recipient.
- */
-typedef struct transaction_t {
-    time_t created_at;
-    char sender[USERNAME_LEN];
-    char recipient[USERNAME_LEN];
-    uint64_t amount;
-} transaction_t;
-
-/**
- * @brief Represents a block in the blockchain.
- * 
- * @param transaction The transaction this block contains.
- * @param proof_of_work A number such that the hash of the block_t contains
- * some number of leading zeros. It has no meaning other than as part of the
- * hash.
- */
-typedef struct block_t {
-    transaction_t transaction;
-    uint64_t proof_of_work;
-} block_t;
-
 //initializing hashtable
 hashtable_t *hashtable = NULL;
 
-//assume each line in the CSV is fewer than 256 characters
-
-int read_transactions(char *filename, transaction_t **arr, int *length) {
-    // check for bad inputs.
-    if (!filename || !arr || !length){return 1;}
-    
-    // open file:
-    FILE *file = fopen(filename, "r");
-
-    //check if there was an error opening the file (file would be NULL).
-    if (!file){return 2;}
-
-    //count the number of lines:
-    int num_lines = 0;
-    char line[256] = {0};
-    while (NULL != fgets(line, sizeof(line), file)) {
-        num_lines ++;
-    }
-
-    //go back to the beginning of the file:
-    rewind(file);
-
-    //create the result array and set the length:
-    *arr = calloc(num_lines, sizeof(transaction_t));
-    *length = num_lines;
-
-    //fill the result array:
-    //Need to convert each line to the transaction fields in transaction_t
-
-    int idx = 0, created = 0, money = 0, i = 0, slen = 0;
-    char sendr[USERNAME_LEN] = {0};
-    char recvr[USERNAME_LEN] = {0};
-
-    while (NULL != fgets(line, sizeof(line), file)) {
-
-        //Reset variables for each line
-        created = 0;
-        money = 0;
-        i = 0;
-        slen = 0;
-
-        //setting created (time) field
-        created += atoi(&line[i]);
-
-        //move i to end of field, which is the ','
-        for (; i < 256; i++){
-            if (line[i] == ','){break;}
-        }
-
-        //incrementing i to first index of the sender field
-        i++;
-
-        //i is now index of the first ','; now set the sender field; slen is used as index and length (at the end)
-        for (; i < 256; i++){
-            if (line[i] == ','){break;}
-            sendr[slen] = (char)(line[i]);
-            slen++;
-        }
-
-        //setting last null char for sendr
-        sendr[slen] = '\0';
-
-        //Setting sender using the length calculated above
-        strncpy(((*arr)[idx]).sender, sendr, slen);
-
-        //resetting slen for second string; receiver
-        slen = 0;
-
-        //incrementing i; is now at first index of the receiver field
-        i++;
-
-        //moving each character into the local recvr string
-        for (; i < 256; i++){
-            if (line[i] == ','){break;}
-            recvr[slen] = (char)(line[i]);
-            slen++;
-        }
+//arena holding the hashtable's nodes, released after the table is printed
+arena_t credit_arena = {0};
 
-        //setting last null char for recvr
-        recvr[slen] = '\0';
-
-        //incrementing i, is now at the first index of the last csv field
-        i++;
-
-        //Setting money (amount)
-        money += atoi(&line[i]);
-
-        //Setting all remaining fields of the transaction_t equal to local variables; sender was set above
-        ((*arr)[idx]).created_at = (time_t)created;
-        //setting recipient using the slen calculated above
-        strncpy(((*arr)[idx]).recipient, recvr, slen);
-        ((*arr)[idx]).amount = (uint64_t)money;
-        //incrementing index for the array as we are moving to a new line in the csv
-        idx++;
-    }
-
-    // Closing the file
-    fclose(file);
-
-    return 0;
-}
-
-//mines a block for each transaction, takes a transaction_t as input
-int mine_block(transaction_t intrans) {
+//mines a block for each transaction, takes a row of the ledger as input
+//the first 128 bytes of the block don't depend on the proof of work, so they are hashed once and each attempt only runs the last compression
+int mine_block(const ledger_t *ledger, int row) {
 
     //initialize block
     block_t block;
+    sha256_midstate_t mid;
+    uint32_t state[SHA256_WORDS];
 
     uint64_t i, j, max = UINT64_MAX;
 
-    //set block to 0s
-    memset(&block, 0, sizeof(block_t));
-   
-    //set block's transaction to the input parameter
-    block.transaction = intrans;
+    //set block to the input row, usernames spelled out
+    build_block(&block, ledger, row);
 
     //set proof of work to 0
     block.proof_of_work = 0;
+    if (sha256_midstate_init(&mid, &block, sizeof(block_t), offsetof(block_t, proof_of_work))){
+        return 1;
+    }
 
-    for (i=0; i <= max; i++){
-        block.proof_of_work = i;
+    //several nonces are tried per compression; the lowest one that hits the target wins
+    if (search_nonces(&mid, 0, max, target_mask, &i)){
         unsigned char digest[SHA256_DIGEST_LENGTH];
-        SHA256((unsigned char *)&block, sizeof(block_t), digest);
-        if (digest[0] == 0 && digest[1] == 0 && digest[2] == 0){
-            printf(
-                "%ld,%s,%s,%lu,%lu,", 
-                block.transaction.created_at, 
-                block.transaction.sender, 
-                block.transaction.recipient, 
-                block.transaction.amount,
-                block.proof_of_work
-            );
-            for (j=0; j < SHA256_DIGEST_LENGTH; j++){
-                printf("%02hhx", digest[j]);
-            }
-            
-            printf("\n");
-            //return 0 if block was successfully mined
-            return 0;
+        block.proof_of_work = i;
+        sha256_midstate_hash(&mid, i, state);
+        sha256_digest_bytes(state, digest);
+        printf(
+            "%ld,%s,%s,%lu,%lu,", 
+            block.transaction.created_at, 
+            block.transaction.sender, 
+            block.transaction.recipient, 
+            block.transaction.amount,
+            block.proof_of_work
+        );
+        for (j=0; j < SHA256_DIGEST_LENGTH; j++){
+            printf("%02hhx", digest[j]);
         }
+        
+        printf("\n");
+        //return 0 if block was successfully mined
+        return 0;
     }
     //return 1 if hashes exhausted, block unsuccessfully mined
     return 1;
@@ -215,73 +94,216 @@ int help(int argc, char *argv[]){
         printf("\npr4: Takes a CSV file as input and prints a list of mined blocks for each transaction, as well as pending balances.\n\n");
         printf("CSV file must be in the format: created_at,sender,recipient,amount.\n\n");
         printf("Usage: pr4 [filename]. Replace [filename] with the name of the CSV file.\n\n");
+        printf("Use - or --stream as the filename to read transactions from stdin in batches.\n\n");
+        printf("Use --difficulty-bits [n] to require n leading zero bits in each digest, from 1 to %d (default %d).\n\n", MAX_DIFFICULTY_BITS, DEFAULT_DIFFICULTY_BITS);
+        printf("Use --checkpoint [file] to only mine the lines added to the CSV since the last run with the same file, adding them to the pending credit it saved.\n\n");
+        printf("Use --hash-backend [name] to pick how nonces are hashed instead of detecting it from the CPU. Backends: ");
+        sha256_print_backends(stdout);
+        printf(".\n\n");
         return 0;
     }
     return 1;
 }
 
-void calculate_pending_credit(transaction_t *arr, int *arrlength) {
+//adds rows [1, length) of the ledger to the pending credit of their recipients
+//returns 4 if a new recipient can't be allocated; the rows from it on are not credited
+int calculate_pending_credit(const ledger_t *ledger) {
+    //only the recipient and amount columns are read
+    const uint32_t *recipient_id = ledger->recipient_id;
+    const uint64_t *amount = ledger->amount;
     int i;
-    for (i=1; i < *arrlength; i++){
+    for (i=1; i < ledger->length; i++){
         hashtable_t *s;
-        HASH_FIND_STR(hashtable, arr[i].recipient, s);
+        HASH_FIND(hh, hashtable, &recipient_id[i], sizeof(uint32_t), s);
         if (s == NULL) {
-            s = (hashtable_t *)malloc(sizeof *s);
-            strncpy(s->username, arr[i].recipient, sizeof(arr[i].recipient) - 1);
-            s->pending_credit = arr[i].amount;
-            HASH_ADD_STR(hashtable, username, s);
+            s = (hashtable_t *)arena_alloc(&credit_arena, sizeof *s);
+            if (!s){
+                fprintf(stderr, "Out of memory for the pending credit table, %d transactions not credited\n", ledger->length - i);
+                return 4;
+            }
+            s->recipient_id = recipient_id[i];
+            s->pending_credit = amount[i];
+            HASH_ADD(hh, hashtable, recipient_id, sizeof(uint32_t), s);
         }
         else {
-            s->pending_credit += arr[i].amount;
+            s->pending_credit += amount[i];
         }
     }
+    return 0;
 }
 
 void iterate_hashtable() {
     hashtable_t *s;
     printf("%s\n", "username,pending_credit");
     for (s = hashtable; s != NULL; s = s->hh.next) {
-        printf("%s,%lu\n", s->username, s->pending_credit);
-        HASH_DEL(hashtable, s);
-        free(s);
+        printf("%s,%lu\n", usernames.names[s->recipient_id], s->pending_credit);
+    }
+    //the nodes live in the arena: drop the table's buckets, then release every node at once
+    HASH_CLEAR(hh, hashtable);
+    arena_release(&credit_arena);
+}
+
+//adds a recipient restored from the checkpoint to the hashtable
+int restore_credit(uint32_t recipient, uint64_t pending_credit, uint64_t i) {
+    hashtable_t *s = (hashtable_t *)arena_alloc(&credit_arena, sizeof *s);
+    if (!s){return 1;}
+    s->recipient_id = recipient;
+    s->pending_credit = pending_credit;
+    HASH_ADD(hh, hashtable, recipient_id, sizeof(uint32_t), s);
+    return 0;
+}
+
+//copies the hashtable out in the order its recipients were first credited; sets *n to how many there are
+//returns NULL (with *n set) if the copy could not be allocated
+credit_entry_t *credit_entries(uint64_t *n) {
+    hashtable_t *s;
+    long i = 0;
+    *n = HASH_COUNT(hashtable);
+    credit_entry_t *entries = malloc((*n ? *n : 1) * sizeof(credit_entry_t));
+    if (!entries){return NULL;}
+    for (s = hashtable; s != NULL; s = s->hh.next) {
+        entries[i].recipient_id = s->recipient_id;
+        entries[i].pending_credit = s->pending_credit;
+        entries[i].first_row = i;
+        i++;
+    }
+    return entries;
+}
+
+//writes the checkpoint from the hashtable
+int save_credit_checkpoint(FILE *in) {
+    uint64_t n;
+    credit_entry_t *entries = credit_entries(&n);
+    if (!entries){return 1;}
+    int status = save_checkpoint(in, entries, n);
+    free(entries);
+    return status;
+}
+
+//streaming mode: reads transactions from in one bounded batch at a time
+//each batch is mined and folded into the pending credit table, so memory only grows with the number of recipients
+int stream_blocks(FILE *in, int resumed) {
+    ledger_t batch;
+    int i, status = 0;
+    char header[256];
+
+    if (alloc_ledger(&batch, STREAM_BATCH + 1)){
+        fprintf(stderr, "Out of memory for a batch of %d transactions\n", STREAM_BATCH);
+        return 4;
+    }
+
+    //skipping the CSV header, which a resumed checkpoint is already past
+    printf("%s", "created_at,sender,recipient,amount,proof,digest\n");
+    if (resumed || NULL != fgets(header, sizeof(header), in)){
+        while (!status && read_batch(in, &batch, checkpoint_path != NULL) > 1){
+            for (i=1; i < batch.length; i++){
+                if (mine_block(&batch, i)){
+                    //error message
+                    printf("%s,%ld,%s,%s,%lu\n", "block mining unsuccessful for transaction: ", batch.created_at[i], usernames.names[batch.sender_id[i]], usernames.names[batch.recipient_id[i]], batch.amount[i]);
+                }
+            }
+            //handing the batch to the reader right away
+            fflush(stdout);
+
+            //adds the batch to the pending credit of its recipients
+            status = calculate_pending_credit(&batch);
+            checkpoint_rows += batch.length - 1;
+        }
+    }
+
+    //saved before the table is printed and freed; a table missing rows is not saved
+    if (!status && checkpoint_path && save_credit_checkpoint(in)){
+        fprintf(stderr, "Could not write checkpoint %s\n", checkpoint_path);
     }
+
+    //iterates through, prints content, and deletes / frees hashtable
+    iterate_hashtable();
+
+    free_ledger(&batch);
+    return status;
+}
+
+//append mode: resumes the CSV called filename from the checkpoint and mines only the rows added since it was saved
+//returns 1 if the file can't be resumed, 4 if it runs out of memory
+int append_blocks(const char *filename) {
+    char magic[8];
+    FILE *in = is_stream(filename) ? NULL : fopen(filename, "r");
+
+    //stdin can't be seeked past the processed prefix
+    if (!in){
+        fprintf(stderr, "Could not open %s\n", filename);
+        return 1;
+    }
+    //binary ledgers are rewritten whole rather than appended to
+    if (fread(magic, 1, sizeof(magic), in) == sizeof(magic) && !memcmp(magic, LEDGER_MAGIC, 8)){
+        fprintf(stderr, "--checkpoint needs a CSV, %s is a binary ledger\n", filename);
+        fclose(in);
+        return 1;
+    }
+    int status = load_checkpoint(in, restore_credit);
+    if (status < 0){
+        fprintf(stderr, "Checkpoint %s does not match %s\n", checkpoint_path, filename);
+        fclose(in);
+        return 1;
+    }
+    //no checkpoint yet: the whole CSV is new
+    if (status){rewind(in);}
+
+    status = stream_blocks(in, !status);
+    fclose(in);
+    return status;
 }
 
 //main is called with one argument: CSV filename
 int main(int argc, char *argv[]) {
     
-    //initializing array of transaction_t structs
-    transaction_t *arr = NULL;
+    //initializing the columns of transactions
+    ledger_t ledger = {0};
 
-    //initializing array length
-    int arrlength = 0, i;
+    //initializing counter variable, and the exit status
+    int i, status = 0;
 
-    if (help(argc, argv)){
+    //options come out of argv first (argc is 0 if one has a bad value)
+    argc = parse_options(argc, argv, NULL);
+    int usage_ok = argc && help(argc, argv) && select_backend();
+
+    if (usage_ok && checkpoint_path){
+
+        //mines the rows added to the CSV since the checkpoint
+        status = append_blocks(argv[1]);
+    }
+    else if (usage_ok && is_stream(argv[1])){
+
+        //reads transactions from stdin batch by batch
+        status = stream_blocks(stdin, 0);
+    }
+    else if (usage_ok){
 
         //reads through provided CSV, builds array of transactions
-        read_transactions(argv[1], &arr, &arrlength);
+        read_transactions(argv[1], &ledger, 1);
 
         //iterates through the array of transactions
         //mines a block for each transaction
         //prints transaction, proof of work, and digest
         printf("%s", "created_at,sender,recipient,amount,proof,digest\n");
-        for (i=1; i < arrlength; i++){
-            if (mine_block(arr[i])){
+        for (i=1; i < ledger.length; i++){
+            if (mine_block(&ledger, i)){
                 //error message
-                printf("%s,%ld,%s,%s,%lu\n", "block mining unsuccessful for transaction: ", arr[i].created_at, arr[i].sender, arr[i].recipient, arr[i].amount);
+                printf("%s,%ld,%s,%s,%lu\n", "block mining unsuccessful for transaction: ", ledger.created_at[i], usernames.names[ledger.sender_id[i]], usernames.names[ledger.recipient_id[i]], ledger.amount[i]);
             }
         }
 
         //builds hashtable of pending credit for recipients
-        calculate_pending_credit(arr, &arrlength);
-        
+        status = calculate_pending_credit(&ledger);
+
         //iterates through, prints content, and deletes / frees hashtable
         iterate_hashtable();
     }
     
 
-    //freeing memory used for arr
-    free(arr);
+    //freeing memory used for the ledger and the usernames
+    free_ledger(&ledger);
+    free_names(&usernames);
     
-    return 0;
+    return status;
 }
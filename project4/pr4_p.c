@@ -1,271 +1,709 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #include <stdint.h>
-#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <pthread.h>
-#include <openssl/sha.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include <stddef.h>
 #include <limits.h>
+#include "../common/ledger.h"
+#include "../common/balances.h"
 #include "uthash.h"
+#include "sha256.h"
+#include "miner.h"
 
-#define USERNAME_LEN 64
-#define SHA256_DIGEST_LENGTH 32
+//bytes per output record: the longest result line is a signed 20 digit time, two 63 character usernames,
+//two 20 digit numbers, the 64 digit hex digest, 5 commas and the newline, 256 bytes
+#define RECORD_WIDTH 256
 
 /**
- * @brief Represents a hashtable for storing pending credit.
+ * @brief Represents a mining thread's private hashtable of pending credit, folded into the account map when the thread is done.
  * 
- * @param username name of user.
+ * @param recipient_id interned username of user.
  * @param pending_credit amount of pending credit.
+ * @param first_row position of the first row crediting the user, carried into the account map.
  * @param hh makes this structure hashable
  */
 
 typedef struct hashtable_t {                   
-    char username[USERNAME_LEN]; //key
+    uint32_t recipient_id; //key
     uint64_t pending_credit; //value
+    long first_row;
     UT_hash_handle hh;  
 } hashtable_t;
 
 
-/**
- * @brief Represents a transaction.
- * 
- * @param created_at The datetime at which the user created this transaction.
- * @param sender The sender's username.
- * @param recipient The recipient's username.
- * @param amount The amount transferred from sender to recipient.
- */
-typedef struct transaction_t {
-    time_t created_at;
-    char sender[USERNAME_LEN];
-    char recipient[USERNAME_LEN];
-    uint64_t amount;
-} transaction_t;
-
-/**
- * @brief Represents a block in the blockchain.
- * 
- * @param transaction The transaction this block contains.
- * @param proof_of_work A number such that the hash of the block_t contains
- * some number of leading zeros. It has no meaning other than as part of the
- * hash.
- */
-typedef struct block_t {
-    transaction_t transaction;
-    uint64_t proof_of_work;
-} block_t;
-
-
 //setting global variables ----
 
 //number of threads used
 int nthreads = 1;
+//number of threads mining the current transactions (at most one per transaction)
+int nworkers = 1;
 //number of transactions (+ header)
 int numelems = 0;
-//array to store strings of completed blocks
-char **res_arr;
-//array of input transactions
-transaction_t *arr = NULL;
-//initializing hashtable
-hashtable_t *hashtable = NULL;
+//next row for a mining thread to claim (row 0 is the CSV header and is not mined)
+atomic_long next_row = 1;
+//one fixed width output record per row, filled in by the mining threads
+char *records = NULL;
+//length of each row's record
+uint16_t *record_len = NULL;
+//columns of the transactions being mined
+ledger_t *ledger = NULL;
+//pending credit each mining thread accumulates for the rows it mines, and the arenas their nodes come from
+hashtable_t **worker_credit = NULL;
+arena_t *worker_arenas = NULL;
+//stages picked with --stages: mined blocks, pending credit, and overdraft checked balances
+int run_mine = 1, run_credit = 1, run_balances = 0;
 
 //------------------------------
 
-//assume each line in the CSV is fewer than 256 characters
-int read_transactions(char *filename, transaction_t **arr, int *length) {
-    // check for bad inputs.
-    if (!filename || !arr || !length){return 1;}
-    
-    // open file:
-    FILE *file = fopen(filename, "r");
-
-    //check if there was an error opening the file (file would be NULL).
-    if (!file){return 2;}
+//writes v in decimal at p; returns the position after it
+static inline char *put_u64(char *p, uint64_t v) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n){
+        *p++ = digits[--n];
+    }
+    return p;
+}
 
-    //count the number of lines:
-    int num_lines = 0;
-    char line[256] = {0};
-    while (NULL != fgets(line, sizeof(line), file)) {
-        num_lines ++;
+static inline char *put_i64(char *p, int64_t v) {
+    if (v < 0){
+        *p++ = '-';
+        return put_u64(p, -(uint64_t)v);
     }
+    return put_u64(p, (uint64_t)v);
+}
 
-    //go back to the beginning of the file:
-    rewind(file);
+//copies a zero padded username
+static inline char *put_name(char *p, const char *name) {
+    size_t n = strnlen(name, BLOCK_NAME_LEN - 1);
+    memcpy(p, name, n);
+    return p + n;
+}
 
-    //create the result array and set the length:
-    *arr = calloc(num_lines, sizeof(transaction_t));
-    *length = num_lines;
+static inline char *put_hex(char *p, const unsigned char *bytes, int n) {
+    static const char hex[] = "0123456789abcdef";
+    int i;
+    for (i=0; i < n; i++){
+        *p++ = hex[bytes[i] >> 4];
+        *p++ = hex[bytes[i] & 15];
+    }
+    return p;
+}
 
-    //fill the result array:
-    //Need to convert each line to the transaction fields in transaction_t
+//formats the result line of row k into its output record
+//found says whether nonce is a valid proof of work for block; mid is the block's midstate
+void store_block(long k, block_t *block, const sha256_midstate_t *mid, int found, uint64_t nonce) {
+    char *start = records + (size_t)k * RECORD_WIDTH, *p = start;
 
-    int idx = 0, created = 0, money = 0, i = 0, slen = 0;
-    char sendr[USERNAME_LEN] = {0};
-    char recvr[USERNAME_LEN] = {0};
+    //if valid digest is found: transaction + proof of work + digest
+    if (found){
+        //recompute the winning hash state of transaction + proof of work
+        uint32_t state[SHA256_WORDS];
+        unsigned char digest[SHA256_DIGEST_LENGTH];
+        sha256_midstate_hash(mid, nonce, state);
+        sha256_digest_bytes(state, digest);
+        //set the proof of work that was found
+        block->proof_of_work = nonce;
 
-    while (NULL != fgets(line, sizeof(line), file)) {
+        p = put_i64(p, block->transaction.created_at);
+        *p++ = ',';
+        p = put_name(p, block->transaction.sender);
+        *p++ = ',';
+        p = put_name(p, block->transaction.recipient);
+        *p++ = ',';
+        p = put_u64(p, block->transaction.amount);
+        *p++ = ',';
+        p = put_u64(p, block->proof_of_work);
+        *p++ = ',';
+        p = put_hex(p, digest, SHA256_DIGEST_LENGTH);
+    }
+    //error handling (if no valid digest is found)
+    else {
+        static const char failed[] = "block mining unsuccessful for transaction: ";
+        memcpy(p, failed, sizeof(failed) - 1);
+        p += sizeof(failed) - 1;
+        p = put_i64(p, ledger->created_at[k]);
+        *p++ = ',';
+        p = put_name(p, usernames.names[ledger->sender_id[k]]);
+        *p++ = ',';
+        p = put_name(p, usernames.names[ledger->recipient_id[k]]);
+        *p++ = ',';
+        p = put_u64(p, ledger->amount[k]);
+    }
+    *p++ = '\n';
+    record_len[k] = (uint16_t)(p - start);
+}
+
+//writes the records of rows [first, end) to stdout with as few writev calls as IOV_MAX allows
+//stdio is flushed first so the records land after anything printed before them
+int write_records(long first, long end) {
+#ifdef IOV_MAX
+    struct iovec iov[IOV_MAX];
+#else
+    struct iovec iov[1024];
+#endif
+    int max_iov = sizeof(iov) / sizeof(iov[0]), n, i;
+    ssize_t written;
 
-        //Reset variables for each line
-        created = 0;
-        money = 0;
+    fflush(stdout);
+    while (first < end){
+        n = (end - first < max_iov) ? (int)(end - first) : max_iov;
+        for (i=0; i < n; i++){
+            iov[i].iov_base = records + (size_t)(first + i) * RECORD_WIDTH;
+            iov[i].iov_len = record_len[first + i];
+        }
+        //a short write leaves the rest of the group for the next round
         i = 0;
-        slen = 0;
+        while (i < n){
+            written = writev(STDOUT_FILENO, iov + i, n - i);
+            if (written < 0){return 1;}
+            while (i < n && (size_t)written >= iov[i].iov_len){
+                written -= iov[i].iov_len;
+                i++;
+            }
+            if (i < n){
+                iov[i].iov_base = (char *)iov[i].iov_base + written;
+                iov[i].iov_len -= written;
+            }
+        }
+        first += n;
+    }
+    return 0;
+}
 
-        //setting created (time) field
-        created += atoi(&line[i]);
+//magic bytes at the start of a proof of work cache file
+#define POW_CACHE_MAGIC "POWCACHE"
+//cache format version this program reads
+#define POW_CACHE_VERSION 1
+//fewest slots a cache file is created with
+#define POW_CACHE_MIN_SLOTS 1024
+//new transactions a stream run makes room for up front; once the cache is 3/4 full new blocks are no longer added
+#define POW_CACHE_STREAM_ROWS (1 << 16)
 
-        //move i to end of field, which is the ','
-        for (; i < 256; i++){
-            if (line[i] == ','){break;}
-        }
+/**
+ * @brief Represents the header of a proof of work cache file, followed by capacity slots.
+ * 
+ * @param magic POW_CACHE_MAGIC.
+ * @param version POW_CACHE_VERSION.
+ * @param capacity Number of slots, a power of two.
+ * @param count Number of slots in use.
+ */
+typedef struct pow_cache_header_t {
+    char magic[8];
+    uint64_t version;
+    uint64_t capacity;
+    uint64_t count;
+} pow_cache_header_t;
+
+/**
+ * @brief Represents one cached block in an open addressed table.
+ * 
+ * @param key Hash of the block's transaction and the difficulty it was mined at, 0 for an empty slot.
+ * @param nonce The block's proof of work + 1, 0 while the slot is being filled in.
+ */
+typedef struct pow_cache_slot_t {
+    uint64_t key;
+    uint64_t nonce;
+} pow_cache_slot_t;
 
-        //incrementing i to first index of the sender field
-        i++;
+//path of the cache picked with --pow-cache, NULL for no cache
+char *pow_cache_path = NULL;
+//the mapped cache file
+pow_cache_header_t *pow_cache = NULL;
+//its slots, right after the header
+pow_cache_slot_t *pow_cache_slots = NULL;
 
-        //i is now index of the first ','; now set the sender field; slen is used as index and length (at the end)
-        for (; i < 256; i++){
-            if (line[i] == ','){break;}
-            sendr[slen] = (char)(line[i]);
-            slen++;
+//FNV-1a over the transaction bytes of the block and the target, never 0
+uint64_t pow_cache_key(const block_t *block) {
+    const unsigned char *p = (const unsigned char *)&block->transaction;
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+    for (i=0; i < sizeof(block_transaction_t); i++){
+        hash = (hash ^ p[i]) * 1099511628211ULL;
+    }
+    //a nonce mined at another difficulty may be valid but isn't the lowest one
+    hash = (hash ^ target_mask) * 1099511628211ULL;
+    return hash ? hash : 1;
+}
+
+//maps a cache file with capacity slots, creating it if it doesn't exist; returns NULL on failure
+pow_cache_header_t *pow_cache_map(const char *path, uint64_t capacity, int create) {
+    size_t size = sizeof(pow_cache_header_t) + capacity * sizeof(pow_cache_slot_t);
+    int fd = open(path, create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0644);
+    if (fd < 0){return NULL;}
+    if (create && ftruncate(fd, size)){
+        close(fd);
+        return NULL;
+    }
+    pow_cache_header_t *header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED){return NULL;}
+    if (create){
+        memcpy(header->magic, POW_CACHE_MAGIC, 8);
+        header->version = POW_CACHE_VERSION;
+        header->capacity = capacity;
+        header->count = 0;
+    }
+    return header;
+}
+
+void pow_cache_unmap(pow_cache_header_t *header) {
+    munmap(header, sizeof(pow_cache_header_t) + header->capacity * sizeof(pow_cache_slot_t));
+}
+
+//stores nonce for key in the slots of header, unless the table is 3/4 full or key is already there
+//mining threads insert concurrently: a slot is claimed by swapping its key in, then published by storing the nonce
+void pow_cache_put(pow_cache_header_t *header, uint64_t key, uint64_t nonce) {
+    pow_cache_slot_t *slots = (pow_cache_slot_t *)(header + 1);
+    uint64_t mask = header->capacity - 1, i, empty;
+    if (__atomic_load_n(&header->count, __ATOMIC_RELAXED) >= header->capacity / 4 * 3){return;}
+    for (i=key & mask; ; i = (i + 1) & mask){
+        empty = 0;
+        if (__atomic_compare_exchange_n(&slots[i].key, &empty, key, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+            __atomic_store_n(&slots[i].nonce, nonce + 1, __ATOMIC_RELEASE);
+            __atomic_fetch_add(&header->count, 1, __ATOMIC_RELAXED);
+            return;
         }
+        if (empty == key){return;}
+    }
+}
 
-        //setting last null char for sendr
-        sendr[slen] = '\0';
+//opens the cache at path sized for a run over rows blocks, growing it into a new file if it is too small
+//a rerun over the same input finds its blocks already cached, so the cache is sized on the larger of rows and its count, not their sum
+//returns 0 on success, 1 if the file isn't a cache or can't be mapped
+int pow_cache_open(const char *path, uint64_t rows) {
+    pow_cache_header_t *old = NULL, *grown;
+    uint64_t capacity = POW_CACHE_MIN_SLOTS, i;
+    char tmp_path[PATH_MAX];
+    struct stat st;
 
-        //Setting sender using the length calculated above
-        strncpy(((*arr)[idx]).sender, sendr, slen);
+    if (!stat(path, &st)){
+        pow_cache_header_t header;
+        int fd = open(path, O_RDONLY);
+        if (fd < 0 || read(fd, &header, sizeof(header)) != sizeof(header) || memcmp(header.magic, POW_CACHE_MAGIC, 8)
+            || header.version != POW_CACHE_VERSION || (header.capacity & (header.capacity - 1))
+            || (uint64_t)st.st_size != sizeof(header) + header.capacity * sizeof(pow_cache_slot_t)){
+            if (fd >= 0){close(fd);}
+            return 1;
+        }
+        close(fd);
+        if (!(old = pow_cache_map(path, header.capacity, 0))){return 1;}
+        if (old->count > rows){
+            rows = old->count;
+        }
+        //a big enough cache is used in place
+        if (2 * rows <= old->capacity){
+            pow_cache = old;
+            pow_cache_slots = (pow_cache_slot_t *)(old + 1);
+            return 0;
+        }
+    }
 
-        //resetting slen for second string; receiver
-        slen = 0;
+    //a new cache, or a bigger copy of the old one renamed over it
+    while (capacity < 2 * rows){
+        capacity *= 2;
+    }
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if (!(grown = pow_cache_map(tmp_path, capacity, 1))){
+        if (old){pow_cache_unmap(old);}
+        return 1;
+    }
+    if (old){
+        pow_cache_slot_t *slots = (pow_cache_slot_t *)(old + 1);
+        for (i=0; i < old->capacity; i++){
+            if (slots[i].key && slots[i].nonce){
+                pow_cache_put(grown, slots[i].key, slots[i].nonce - 1);
+            }
+        }
+        pow_cache_unmap(old);
+    }
+    if (rename(tmp_path, path)){
+        pow_cache_unmap(grown);
+        unlink(tmp_path);
+        return 1;
+    }
+    pow_cache = grown;
+    pow_cache_slots = (pow_cache_slot_t *)(grown + 1);
+    return 0;
+}
 
-        //incrementing i; is now at first index of the receiver field
-        i++;
+//writes the cache back and unmaps it
+void pow_cache_close(void) {
+    if (!pow_cache){return;}
+    msync(pow_cache, sizeof(pow_cache_header_t) + pow_cache->capacity * sizeof(pow_cache_slot_t), MS_SYNC);
+    pow_cache_unmap(pow_cache);
+    pow_cache = NULL;
+    pow_cache_slots = NULL;
+}
 
-        //moving each character into the local recvr string
-        for (; i < 256; i++){
-            if (line[i] == ','){break;}
-            recvr[slen] = (char)(line[i]);
-            slen++;
+//looks the block up in the cache; a hit is only trusted once its nonce hashes to the target, one SHA-256 of the last block
+//returns 1 and sets *nonce on a verified hit
+int pow_cache_get(const block_t *block, const sha256_midstate_t *mid, uint64_t *nonce) {
+    uint64_t key, mask, i, slot_key, value;
+    uint32_t state[SHA256_WORDS];
+    if (!pow_cache){return 0;}
+    key = pow_cache_key(block);
+    mask = pow_cache->capacity - 1;
+    for (i=key & mask; (slot_key = __atomic_load_n(&pow_cache_slots[i].key, __ATOMIC_ACQUIRE)); i = (i + 1) & mask){
+        if (slot_key == key){
+            //0 means another thread is still filling the slot in: mine the block instead
+            value = __atomic_load_n(&pow_cache_slots[i].nonce, __ATOMIC_ACQUIRE);
+            if (!value){return 0;}
+            sha256_midstate_hash(mid, value - 1, state);
+            if (state[0] & target_mask){return 0;}
+            *nonce = value - 1;
+            return 1;
         }
+    }
+    return 0;
+}
+
+//opens the --pow-cache file, if one was given, sized for a run over rows blocks; returns 0 if it can't be used
+int open_pow_cache(uint64_t rows) {
+    if (pow_cache_path && pow_cache_open(pow_cache_path, rows)){
+        printf("\nCan't use %s as a proof of work cache\n\n", pow_cache_path);
+        return 0;
+    }
+    return 1;
+}
+
+//finds the proof of work of the block: from the cache if it has it, otherwise by searching, adding what is found to the cache
+int find_nonce(const block_t *block, const sha256_midstate_t *mid, uint64_t *nonce) {
+    if (pow_cache_get(block, mid, nonce)){return 1;}
+    if (!search_nonces(mid, 0, UINT64_MAX, target_mask, nonce)){return 0;}
+    if (pow_cache){
+        pow_cache_put(pow_cache, pow_cache_key(block), *nonce);
+    }
+    return 1;
+}
 
-        //setting last null char for recvr
-        recvr[slen] = '\0';
+//fewest slots the account map is allocated with
+#define CREDIT_MAP_MIN_SLOTS 1024
 
-        //incrementing i, is now at the first index of the last csv field
-        i++;
+/**
+ * @brief Represents a slot of the account map. Every field is only read and written atomically.
+ * 
+ * @param key interned username of the account + 1, 0 while the slot is free; set once, by compare and swap.
+ * @param pending_credit amount of pending credit, added to with fetch_add.
+ * @param first_row position of the first row crediting the account across every batch so far, which orders the output.
+ */
+typedef struct credit_slot_t {
+    atomic_uint_least32_t key;
+    atomic_uint_fast64_t pending_credit;
+    atomic_long first_row;
+} credit_slot_t;
+
+/**
+ * @brief Represents the pending credit of every account as an open addressing map that threads update without a lock.
+ * 
+ * @param slots capacity slots, probed linearly from the hash of the key.
+ * @param capacity Number of slots, a power of two kept at least twice the number of accounts by credit_map_reserve.
+ * @param count Number of slots in use.
+ */
+typedef struct credit_map_t {
+    credit_slot_t *slots;
+    uint64_t capacity;
+    atomic_uint_fast64_t count;
+} credit_map_t;
+
+//pending credit of every account, shared by all threads
+credit_map_t credit_map = {0};
+//position of row 0 of the current batch among all rows credited so far, so first_row keeps ordering across batches
+long credit_row_base = 0;
+
+//spreads the dense interned ids over the slots
+static inline uint64_t credit_map_slot(uint32_t recipient, uint64_t capacity) {
+    return ((uint64_t)recipient * 0x9E3779B97F4A7C15ULL >> 32) & (capacity - 1);
+}
 
-        //Setting money (amount)
-        money += atoi(&line[i]);
+//adds amount to recipient's pending credit, taking a free slot for the account if it has none
+//safe to call from any number of threads at once, as long as the map was reserved for every account they credit
+void credit_map_add(uint32_t recipient, uint64_t amount, long row) {
+    credit_slot_t *slots = credit_map.slots;
+    uint64_t i = credit_map_slot(recipient, credit_map.capacity);
+    uint_least32_t key = recipient + 1, found;
+    long first;
 
-        //Setting all remaining fields of the transaction_t equal to local variables; sender was set above
-        ((*arr)[idx]).created_at = (time_t)created;
-        //setting recipient using the slen calculated above
-        strncpy(((*arr)[idx]).recipient, recvr, slen);
-        ((*arr)[idx]).amount = (uint64_t)money;
-        //incrementing index for the array as we are moving to a new line in the csv
-        idx++;
+    for (;;){
+        found = atomic_load_explicit(&slots[i].key, memory_order_acquire);
+        //claims the free slot; a thread losing the race learns which account took it
+        if (found == 0 && atomic_compare_exchange_strong(&slots[i].key, &found, key)){
+            atomic_fetch_add(&credit_map.count, 1);
+            found = key;
+        }
+        if (found == key){
+            break;
+        }
+        i = (i + 1) & (credit_map.capacity - 1);
     }
+    atomic_fetch_add_explicit(&slots[i].pending_credit, amount, memory_order_relaxed);
+    first = atomic_load_explicit(&slots[i].first_row, memory_order_relaxed);
+    while (row < first && !atomic_compare_exchange_weak(&slots[i].first_row, &first, row)){}
+}
+
+//grows the map to hold accounts accounts without probing long; not safe while other threads add to it
+//returns 1 if the slots could not be allocated
+int credit_map_reserve(uint64_t accounts) {
+    uint64_t capacity = CREDIT_MAP_MIN_SLOTS, i;
+    credit_map_t old = {0};
+
+    while (capacity < 2 * accounts){capacity *= 2;}
+    if (credit_map.slots && capacity <= credit_map.capacity){return 0;}
 
-    // Closing the file
-    fclose(file);
+    credit_slot_t *slots = malloc(capacity * sizeof(credit_slot_t));
+    if (!slots){return 1;}
+    for (i=0; i < capacity; i++){
+        atomic_init(&slots[i].key, 0);
+        atomic_init(&slots[i].pending_credit, 0);
+        atomic_init(&slots[i].first_row, LONG_MAX);
+    }
+    old.slots = credit_map.slots;
+    old.capacity = credit_map.capacity;
+    credit_map.slots = slots;
+    credit_map.capacity = capacity;
+    atomic_store(&credit_map.count, 0);
+
+    //moves the accounts over, keeping their first rows
+    for (i=0; i < old.capacity; i++){
+        uint_least32_t key = atomic_load(&old.slots[i].key);
+        if (key){
+            credit_map_add(key - 1, atomic_load(&old.slots[i].pending_credit), atomic_load(&old.slots[i].first_row));
+        }
+    }
+    free(old.slots);
     return 0;
 }
 
+//frees the map's slots, leaving it empty
+void credit_map_free(void) {
+    free(credit_map.slots);
+    credit_map.slots = NULL;
+    credit_map.capacity = 0;
+    atomic_store(&credit_map.count, 0);
+}
+
+int compare_first_row(const void *a, const void *b) {
+    long x = ((const credit_entry_t *)a)->first_row, y = ((const credit_entry_t *)b)->first_row;
+    return (x > y) - (x < y);
+}
+
+//copies every account out of the map in the order they were first credited; sets *n to how many there are
+//count is read before the slots are scanned, so the copy is only consistent once no thread adds to the map;
+//every caller runs after the miners are joined
+//returns NULL (with *n set) if the copy could not be allocated
+credit_entry_t *credit_map_snapshot(uint64_t *n) {
+    uint64_t i, len = 0;
+    *n = atomic_load(&credit_map.count);
+    credit_entry_t *entries = malloc((*n ? *n : 1) * sizeof(credit_entry_t));
+    if (!entries){return NULL;}
+    for (i=0; i < credit_map.capacity && len < *n; i++){
+        uint_least32_t key = atomic_load_explicit(&credit_map.slots[i].key, memory_order_acquire);
+        if (key){
+            entries[len].recipient_id = key - 1;
+            entries[len].pending_credit = atomic_load(&credit_map.slots[i].pending_credit);
+            entries[len].first_row = atomic_load(&credit_map.slots[i].first_row);
+            len++;
+        }
+    }
+    *n = len;
+    qsort(entries, len, sizeof(credit_entry_t), compare_first_row);
+    return entries;
+}
+
+//adds amount to recipient in table, remembering the first row that credited them
+//if the table can't take a new recipient the row goes straight to the account map, which is already sized for every account
+void add_credit(hashtable_t **table, arena_t *arena, uint32_t recipient, uint64_t amount, long row) {
+    hashtable_t *s;
+    HASH_FIND(hh, *table, &recipient, sizeof(uint32_t), s);
+    if (s == NULL) {
+        s = (hashtable_t *)arena_alloc(arena, sizeof *s);
+        if (!s){
+            credit_map_add(recipient, amount, row);
+            return;
+        }
+        s->recipient_id = recipient;
+        s->pending_credit = amount;
+        s->first_row = row;
+        HASH_ADD(hh, *table, recipient_id, sizeof(uint32_t), s);
+    }
+    else {
+        s->pending_credit += amount;
+        if (row < s->first_row){s->first_row = row;}
+    }
+}
+
 //mines a block for each transaction
 void * mine_blocks(void * rank) {
     //thread number
-    long myrank = (long)(rank);
-    //work each thread will do
-    long mywork = numelems / nthreads;
-    //start index in transaction array
-    long start = myrank * mywork;
-    //end index in transaction array
-    long end = start + mywork;
-    //counter for iteration
+    long myrank = (long)rank;
+    //row being mined
     long k;
-    //account for uneven distribution of work
-    if (myrank == nthreads - 1){
-        end = numelems;
-    }
-    
-    //outer loop (mines a block for each transaction in mywork)
-    for (k = start; k < end; k++){
+
+    //outer loop (claims the next unmined row until none are left)
+    //a row at a time: mining one block dwarfs the atomic, and a thread stuck on an unlucky block no longer holds up the rows after it
+    while ((k = atomic_fetch_add(&next_row, 1)) < numelems){
 
         //initialize block
         block_t block;
-        //initialize counter variables
-        uint64_t i, j, max = UINT64_MAX;
+        //proof of work found
+        uint64_t nonce = 0;
         //variable to determine if valid hash exists
-        int exhausted = 1;
+        int found = 0;
 
-        //set block to 0s
-        memset(&block, 0, sizeof(block_t));
-    
-        //set block's transaction to the current transaction
-        block.transaction = arr[k];
+        //set block to the current transaction, usernames spelled out
+        build_block(&block, ledger, k);
         
         //set proof of work to 0
         block.proof_of_work = 0;
 
-        //inner for loop (iterates through proof of work until block is mined)
-        for (i=0; i < max; i++){
-            //increment proof of work
-            block.proof_of_work = i;
-            //initialize hash digest
-            unsigned char digest[SHA256_DIGEST_LENGTH];
-            //calculate hash digest of transaction + proof of work
-            SHA256((unsigned char *)&block, sizeof(block_t), digest);
-
-            //if valid digest is found...
-            if (digest[0] == 0 && digest[1] == 0 && digest[2] == 0){
-                //create temporary string to store the hash digest
-                char *digest_str = malloc(SHA256_DIGEST_LENGTH * 2 + 1);
-                //allocate space for string in the result array to store transaction + digest
-                res_arr[k] = (char *)malloc(sizeof(block) + sizeof(digest_str) + 1);
-
-                //iterate through digest and convert to string
-                for (j=0; j < SHA256_DIGEST_LENGTH; j++){
-                    sprintf(digest_str + j * 2, "%02hhx", digest[j]);
-                }
-                //set last char to \0
-                digest_str[SHA256_DIGEST_LENGTH * 2] = '\0';
-
-                //add all transaction + proof of work + digest string to result array
-                sprintf(
-                    res_arr[k],
-                    "%ld,%s,%s,%lu,%lu,%s", 
-                    block.transaction.created_at, 
-                    block.transaction.sender, 
-                    block.transaction.recipient, 
-                    block.transaction.amount,
-                    block.proof_of_work,
-                    digest_str
-                );
-
-                //free temporary digest string
-                exhausted = 0;
-                free(digest_str);
-                break;
-            }
+        //hash the 128 bytes before the proof of work once, then search the proof of work several nonces per compression
+        sha256_midstate_t mid;
+        if (!sha256_midstate_init(&mid, &block, sizeof(block_t), offsetof(block_t, proof_of_work))){
+            found = find_nonce(&block, &mid, &nonce);
         }
 
-        //error handling (if no valid digest is found)
-        if (exhausted){
-            res_arr[k] = (char *)malloc(sizeof(arr[k]) + 44);
-            sprintf(
-                res_arr[k],
-                "%s%ld,%s,%s,%lu",
-                "block mining unsuccessful for transaction: ",
-                arr[k].created_at,
-                arr[k].sender,
-                arr[k].recipient,
-                arr[k].amount
-            );
+        store_block(k, &block, &mid, found, nonce);
+
+        //credits the recipient in this thread's pending credit table while the row is at hand instead of in a serial pass after the join
+        if (run_credit){
+            add_credit(&worker_credit[myrank], &worker_arenas[myrank], ledger->recipient_id[k], ledger->amount[k], credit_row_base + k);
+        }
+    }
+
+    //folds the thread's table into the shared map alongside the other threads; one atomic add per recipient, not per row
+    hashtable_t *s;
+    for (s = worker_credit[myrank]; s != NULL; s = s->hh.next) {
+        credit_map_add(s->recipient_id, s->pending_credit, s->first_row);
+    }
+    HASH_CLEAR(hh, worker_credit[myrank]);
+    arena_release(&worker_arenas[myrank]);
+    return NULL;
+}
+
+//nonces a thread claims at a time when all threads search the same block; a few milliseconds of hashing
+#define NONCE_CHUNK (1 << 16)
+
+//midstate of the block every thread is searching
+sha256_midstate_t shared_mid;
+//next chunk of nonces to claim
+atomic_uint_fast64_t next_chunk = 0;
+//lowest valid nonce found so far, UINT64_MAX while there is none
+atomic_uint_fast64_t best_nonce = UINT64_MAX;
+
+//searches chunks of the shared block's nonces until every chunk below the best nonce found has been searched
+//chunks are claimed in increasing order and each is searched to its end, so the result is the lowest valid nonce whatever the thread timing
+void * search_shared_block(void * unused) {
+    uint64_t chunk, nonce, best;
+    while ((chunk = atomic_fetch_add(&next_chunk, 1)) < UINT64_MAX / NONCE_CHUNK){
+        //stop once a lower chunk holds a valid nonce
+        if (chunk * NONCE_CHUNK >= atomic_load(&best_nonce)){
+            break;
+        }
+        if (search_nonces(&shared_mid, chunk * NONCE_CHUNK, NONCE_CHUNK, target_mask, &nonce)){
+            //publish the nonce unless a lower one is already there
+            best = atomic_load(&best_nonce);
+            while (nonce < best && !atomic_compare_exchange_weak(&best_nonce, &best, nonce)){}
+            break;
         }
     }
     return NULL;
 }
 
+//mines row k with every thread searching its nonces
+void mine_block_together(long k, pthread_t *thread_array) {
+    block_t block;
+    uint64_t nonce = 0;
+    long i;
+    int found;
+
+    build_block(&block, ledger, k);
+    block.proof_of_work = 0;
+    if (sha256_midstate_init(&shared_mid, &block, sizeof(block_t), offsetof(block_t, proof_of_work))){
+        found = 0;
+    }
+    //a cached block needs no search
+    else if (pow_cache_get(&block, &shared_mid, &nonce)){
+        found = 1;
+    }
+    else {
+        atomic_store(&next_chunk, 0);
+        atomic_store(&best_nonce, UINT64_MAX);
+        for (i=0; i < nthreads; i++){
+            pthread_create(&thread_array[i], NULL, search_shared_block, NULL);
+        }
+        for (i=0; i < nthreads; i++){
+            pthread_join(thread_array[i], NULL);
+        }
+        //a nonce of UINT64_MAX is never searched, so it means none was found
+        nonce = atomic_load(&best_nonce);
+        found = nonce != UINT64_MAX;
+        if (found && pow_cache){
+            pow_cache_put(pow_cache, pow_cache_key(&block), nonce);
+        }
+    }
+    store_block(k, &block, &shared_mid, found, nonce);
+}
+
+
+//set by --verify: the file holds mined output to check instead of transactions to mine
+int verify_mode = 0;
+
+//picks the stages from a --stages value, a comma separated list of mine, credit and balances
+//returns 0 if a stage is unknown or none is given
+int set_stages(const char *value){
+    const char *p = value;
+    run_mine = run_credit = run_balances = 0;
+    while (*p){
+        size_t len = strcspn(p, ",");
+        if (len == 4 && !strncmp(p, "mine", 4)){run_mine = 1;}
+        else if (len == 6 && !strncmp(p, "credit", 6)){run_credit = 1;}
+        else if (len == 8 && !strncmp(p, "balances", 8)){run_balances = 1;}
+        else if (len){
+            printf("\nUnknown stage %.*s. Stages: mine, credit, balances\n\n", (int)len, p);
+            return 0;
+        }
+        p += len + (p[len] == ',');
+    }
+    if (!run_mine && !run_credit && !run_balances){
+        printf("\nNo stage picked. Stages: mine, credit, balances\n\n");
+        return 0;
+    }
+    return 1;
+}
+
+//pr4_p's own options, next to the ones every miner takes
+int parse_pr4_p_option(int argc, char *argv[], int *i, int *ok){
+    if (!strcmp(argv[*i], "--pow-cache") && *i + 1 < argc){
+        pow_cache_path = argv[++*i];
+    }
+    else if (!strncmp(argv[*i], "--pow-cache=", 12)){
+        pow_cache_path = argv[*i] + 12;
+    }
+    else if (!strcmp(argv[*i], "--stages") && *i + 1 < argc){
+        *ok = set_stages(argv[++*i]) && *ok;
+    }
+    else if (!strncmp(argv[*i], "--stages=", 9)){
+        *ok = set_stages(argv[*i] + 9) && *ok;
+    }
+    else if (!strcmp(argv[*i], "--verify")){
+        verify_mode = 1;
+    }
+    else {
+        return 0;
+    }
+    return 1;
+}
 
 //checks for correct usage
 int help(int argc, char *argv[]){
@@ -282,102 +720,545 @@ int help(int argc, char *argv[]){
         printf("CSV file must be in the format: created_at,sender,recipient,amount.\n\n");
         printf("It is recommended the number of threads used be less than or equal to the available cores on your computer.\n\n");
         printf("Usage: pr4 [filename] [numthreads]. Replace [filename] with the name of the CSV file and [numthreads] with the number of threads to use.\n\n");
+        printf("Use - or --stream as the filename to read transactions from stdin in batches.\n\n");
+        printf("Use --difficulty-bits [n] to require n leading zero bits in each digest, from 1 to %d (default %d).\n\n", MAX_DIFFICULTY_BITS, DEFAULT_DIFFICULTY_BITS);
+        printf("Use --pow-cache [file] to keep found proofs of work in file and reuse them on later runs instead of mining those blocks again.\n\n");
+        printf("Use --checkpoint [file] to only mine the lines added to the CSV since the last run with the same file, adding them to the pending credit it saved.\n\n");
+        printf("Use --stages [list] to pick what runs over the one parse of the CSV, as a comma separated list (default mine,credit): mine prints a mined block per transaction, credit the pending credit of every recipient, balances the account balances pr1 computes, sorted and overdraft checked alongside the miners.\n\n");
+        printf("Use --verify to check the blocks printed by a previous run instead: pr4 --verify [output] [numthreads] rehashes every block and checks its digest and difficulty, printing the lines that fail.\n\n");
+        printf("Use --hash-backend [name] to pick how nonces are hashed instead of detecting it from the CPU. Backends: ");
+        sha256_print_backends(stdout);
+        printf(".\n\n");
         return 0;
     }
     return 1;
 }
 
-//calculate pending credit using hashtable
-void calculate_pending_credit(transaction_t *arr, int *arrlength) {
+//calculate pending credit using the account map
+void calculate_pending_credit(const ledger_t *ledger) {
+    //only the recipient and amount columns are read
+    const uint32_t *recipient_id = ledger->recipient_id;
+    const uint64_t *amount = ledger->amount;
     int i;
-    for (i=1; i < *arrlength; i++){
-        hashtable_t *s;
-        HASH_FIND_STR(hashtable, arr[i].recipient, s);
-        if (s == NULL) {
-            s = (hashtable_t *)malloc(sizeof *s);
-            strncpy(s->username, arr[i].recipient, sizeof(arr[i].recipient) - 1);
-            s->pending_credit = arr[i].amount;
-            HASH_ADD_STR(hashtable, username, s);
-        }
-        else {
-            s->pending_credit += arr[i].amount;
-        }
+    for (i=1; i < ledger->length; i++){
+        credit_map_add(recipient_id[i], amount[i], credit_row_base + i);
     }
 }
 
-//iterate through hashtable to print pending credit and free hashtable memory
+//iterate through a snapshot of the account map to print pending credit, then free the map
 void iterate_hashtable() {
-    hashtable_t *s;
+    uint64_t n, i;
+    credit_entry_t *entries = credit_map_snapshot(&n);
     printf("%s\n", "username,pending_credit");
-    for (s = hashtable; s != NULL; s = s->hh.next) {
-        printf("%s,%lu\n", s->username, s->pending_credit);
-        HASH_DEL(hashtable, s);
-        free(s);
+    for (i=0; entries && i < n; i++) {
+        printf("%s,%lu\n", usernames.names[entries[i].recipient_id], entries[i].pending_credit);
     }
+    free(entries);
+    credit_map_free();
+    credit_row_base = 0;
 }
 
-//main is called with two arguments: CSV filename, num threads
-int main(int argc, char *argv[]) {
+//account balances of the balances stage, carried over between batches
+balance_state_t balances = {0};
+//thread running the balances stage alongside the miners, and whether it was started
+pthread_t balances_thread;
+int balances_running = 0;
+
+//balances stage: folds rows [1, length) into the account balances in time order
+//the miners keep reading the rows in file order, so the stage sorts its own copy
+void * balance_rows(void * rows) {
+    ledger_t view;
+    if (!sorted_view((const ledger_t *)rows, &view, 1)){
+        update_balances(&balances, &view, 1);
+        free_ledger(&view);
+    }
+    return NULL;
+}
+
+//starts the balances stage on rows, if it was picked; it runs inline if its thread can't be started
+void start_balances(const ledger_t *rows) {
+    if (!run_balances){return;}
+    balances_running = !pthread_create(&balances_thread, NULL, balance_rows, (void *)rows);
+    if (!balances_running){
+        balance_rows((void *)rows);
+    }
+}
 
-    //initializing counter variable
+//waits for the balances stage to be done with the rows it was started on
+void finish_balances(void) {
+    if (balances_running){
+        pthread_join(balances_thread, NULL);
+        balances_running = 0;
+    }
+}
+
+//prints the account balances in order of first appearance (as pr1 does) and frees them
+void print_balances(void) {
     int i;
+    printf("username,balance\n");
+    for (i=0; i < balances.dictlength; i++){
+        printf("%s,%lu\n", usernames.names[balances.dict[i].user_id], balances.dict[i].amount);
+    }
+    free_balances(&balances);
+}
 
-    //call help to ensure correct usage
-    if (help(argc, argv)){
+//mines rows [1, numelems) of the ledger with up to nthreads threads, then prints the blocks in order
+//and adds the rows to the pending credit of their recipients; only the stages picked with --stages run
+void mine_transactions(pthread_t *thread_array) {
+    long i;
 
-        //set number of threads
-        nthreads = strtol(argv[2], NULL, 10);
+    //room for every account the batch can credit, before any thread adds to the map
+    //without it the workers would add to missing slots, so the batch is skipped
+    if (run_credit && credit_map_reserve(usernames.count)){
+        fprintf(stderr, "Out of memory for the account map, skipping %d transactions\n", numelems - 1);
+        credit_row_base += numelems - 1;
+        return;
+    }
 
-        //allocate thread array
-        pthread_t *thread_array = malloc(nthreads * sizeof(pthread_t));
+    //without the mine stage the rows are only credited
+    if (!run_mine){
+        if (run_credit){calculate_pending_credit(ledger);}
+        credit_row_base += numelems - 1;
+        return;
+    }
 
-        //reads through provided CSV, builds array of transactions
-        //sets numelems correctly
-        read_transactions(argv[1], &arr, &numelems);
-        
-        //allocate space for result array (stores output strings)
-        res_arr = (char **)malloc(numelems * sizeof(char *));
+    //ensure only 1 thread per element at most
+    nworkers = nthreads;
+    if (numelems - 1 < nworkers){
+        nworkers = numelems - 1;
+    }
 
-        //ensure only 1 thread per element at most
-        if (numelems < nthreads){
-            nthreads = numelems;
+    //fewer transactions than threads: rather than leave threads idle, all of them search each block in turn
+    if (numelems - 1 < nthreads){
+        nworkers = 1;
+        for (i=1; i < numelems; i++){
+            mine_block_together(i, thread_array);
         }
-
-        //print header
-        printf("%s", "created_at,sender,recipient,amount,proof,digest\n");
+        if (run_credit){calculate_pending_credit(ledger);}
+    }
+    else {
+        //hand out rows from the first transaction
+        atomic_store(&next_row, 1);
 
         //create threads, each thread calls mine_blocks
-        for (i=0; i < nthreads; i++){
+        for (i=0; i < nworkers; i++){
             pthread_create(&thread_array[i], NULL, mine_blocks, (void *)i);
         }
 
         //join threads when work is complete
-        for (i = 0; i < nthreads; i++) {
+        for (i = 0; i < nworkers; i++) {
             pthread_join(thread_array[i], NULL);
         }
+    }
 
-        //iterate through result array when complete, print out lines in order
-        //frees memory for each string in the array
-        free(res_arr[0]);
-        for (i=1; i < numelems; i ++){
-            printf("%s\n", res_arr[i]);
-            free(res_arr[i]);
+    //print the records in row order, all at once
+    write_records(1, numelems);
+
+    //the next batch's rows come after this one's
+    credit_row_base += numelems - 1;
+}
+
+//adds a recipient restored from the checkpoint to the account map
+int restore_credit(uint32_t recipient, uint64_t pending_credit, uint64_t i) {
+    if (credit_map_reserve(usernames.count)){return 1;}
+    credit_map_add(recipient, pending_credit, (long)i);
+    //rows mined from here on are credited after every restored account
+    credit_row_base = (long)i + 1;
+    return 0;
+}
+
+//writes the checkpoint from the account map
+int save_credit_checkpoint(FILE *in) {
+    uint64_t n;
+    credit_entry_t *entries = credit_map_snapshot(&n);
+    if (!entries){return 1;}
+    int status = save_checkpoint(in, entries, n);
+    free(entries);
+    return status;
+}
+
+//streaming mode: reads transactions from in one bounded batch at a time
+//each batch is mined by the thread pool and folded into the pending credit table, so memory only grows with the number of recipients
+int stream_blocks(FILE *in, pthread_t *thread_array, int resumed) {
+    ledger_t batch;
+    char header[256];
+
+    if (alloc_ledger(&batch, STREAM_BATCH + 1)){
+        fprintf(stderr, "Out of memory for a batch of %d transactions\n", STREAM_BATCH);
+        return 4;
+    }
+
+    //output records sized for one batch
+    records = malloc((size_t)(STREAM_BATCH + 1) * RECORD_WIDTH);
+    record_len = malloc((STREAM_BATCH + 1) * sizeof(uint16_t));
+    if (!records || !record_len){
+        fprintf(stderr, "Out of memory for the output of %d transactions\n", STREAM_BATCH);
+        free(records);
+        free(record_len);
+        records = NULL;
+        record_len = NULL;
+        free_ledger(&batch);
+        return 4;
+    }
+
+    //skipping the CSV header, which a resumed checkpoint is already past
+    if (run_mine){
+        printf("%s", "created_at,sender,recipient,amount,proof,digest\n");
+    }
+    if (resumed || NULL != fgets(header, sizeof(header), in)){
+        ledger = &batch;
+        while ((numelems = read_batch(in, &batch, checkpoint_path != NULL)) > 1){
+            //mines the batch, hands it to the reader right away and adds it to the pending credit of its recipients
+            //while the balances stage folds the same batch in
+            start_balances(&batch);
+            mine_transactions(thread_array);
+            finish_balances();
+            checkpoint_rows += numelems - 1;
         }
+        ledger = NULL;
+    }
 
-        //builds hashtable of pending credit for recipients
-        calculate_pending_credit(arr, &numelems);
-        
-        //iterates through, prints content, and deletes / frees hashtable
+    //saved before the table is printed and freed
+    if (checkpoint_path && save_credit_checkpoint(in)){
+        fprintf(stderr, "Could not write checkpoint %s\n", checkpoint_path);
+    }
+
+    //iterates through, prints content, and frees the account map
+    if (run_credit){
         iterate_hashtable();
+    }
+    if (run_balances){
+        print_balances();
+    }
+
+    free_ledger(&batch);
+    free(records);
+    free(record_len);
+    records = NULL;
+    record_len = NULL;
+    return 0;
+}
+
+//append mode: resumes the CSV called filename from the checkpoint and mines only the rows added since it was saved
+//returns 1 if the file can't be resumed, 4 if it runs out of memory
+int append_blocks(const char *filename, pthread_t *thread_array) {
+    char magic[8];
+    FILE *in = is_stream(filename) ? NULL : fopen(filename, "r");
+
+    //stdin can't be seeked past the processed prefix
+    if (!in){
+        fprintf(stderr, "Could not open %s\n", filename);
+        return 1;
+    }
+    //binary ledgers are rewritten whole rather than appended to
+    if (fread(magic, 1, sizeof(magic), in) == sizeof(magic) && !memcmp(magic, LEDGER_MAGIC, 8)){
+        fprintf(stderr, "--checkpoint needs a CSV, %s is a binary ledger\n", filename);
+        fclose(in);
+        return 1;
+    }
+    int status = load_checkpoint(in, restore_credit);
+    if (status < 0){
+        fprintf(stderr, "Checkpoint %s does not match %s\n", checkpoint_path, filename);
+        fclose(in);
+        return 1;
+    }
+    //no checkpoint yet: the whole CSV is new
+    if (status){rewind(in);}
+    if (!open_pow_cache(POW_CACHE_STREAM_ROWS)){
+        fclose(in);
+        return 1;
+    }
+
+    status = stream_blocks(in, thread_array, !status);
+    fclose(in);
+    return status;
+}
+
+//rows a verifying thread claims at a time; a multiple of the widest kernel's 16 lanes
+#define VERIFY_CHUNK 256
+
+//outcome of checking a line of mined output
+#define VERIFY_OK 0
+#define VERIFY_MALFORMED 1
+#define VERIFY_UNMINED 2
+#define VERIFY_DIGEST 3
+#define VERIFY_DIFFICULTY 4
 
-        //free threads
+//why a line failed, indexed by its outcome
+const char *verify_reasons[] = {"ok", "malformed line", "block was not mined", "digest does not match the block", "digest misses the difficulty target"};
+
+//per row of the verify batch: the claimed proof of work and digest, the outcome, and the line it came from
+uint64_t *claimed_proof = NULL;
+unsigned char (*claimed_digest)[SHA256_DIGEST_LENGTH] = NULL;
+unsigned char *verify_status = NULL;
+long *verify_line = NULL;
+
+//decodes the 2 * n hex digits at p into bytes; returns 0 if one isn't a lowercase or uppercase hex digit
+int parse_hex(const char *p, unsigned char *bytes, int n) {
+    int i, j, v;
+    for (i=0; i < n; i++){
+        bytes[i] = 0;
+        for (j=0; j < 2; j++){
+            char c = p[2 * i + j];
+            if (c >= '0' && c <= '9'){v = c - '0';}
+            else if (c >= 'a' && c <= 'f'){v = c - 'a' + 10;}
+            else if (c >= 'A' && c <= 'F'){v = c - 'A' + 10;}
+            else {return 0;}
+            bytes[i] = (unsigned char)(bytes[i] << 4 | v);
+        }
+    }
+    return 1;
+}
+
+//parses a line of mined output [line, end) into row of batch and its claimed proof of work and digest
+//returns the outcome known before hashing: VERIFY_OK if the line still has to be hashed
+int parse_mined(const char *line, const char *end, ledger_t *batch, int row) {
+    static const char failed[] = "block mining unsuccessful for transaction: ";
+    const char *commas[5], *p = line;
+    int ncomma = 0;
+
+    //the miner gave up on this transaction; keep it so it can be reported
+    if (!strncmp(line, failed, sizeof(failed) - 1)){
+        parse_transaction(line + sizeof(failed) - 1, end, &usernames, batch, row);
+        return VERIFY_UNMINED;
+    }
+    while (ncomma < 5 && (p = memchr(p, ',', end - p))){
+        commas[ncomma++] = p++;
+    }
+    parse_transaction(line, ncomma > 3 ? commas[3] : end, &usernames, batch, row);
+    if (ncomma < 5 || commas[4] - commas[3] < 2 || end - commas[4] - 1 != 2 * SHA256_DIGEST_LENGTH
+        || !parse_hex(commas[4] + 1, claimed_digest[row], SHA256_DIGEST_LENGTH)){
+        return VERIFY_MALFORMED;
+    }
+    claimed_proof[row] = strtoull(commas[3] + 1, NULL, 10);
+    return VERIFY_OK;
+}
+
+//reads up to STREAM_BATCH blocks of mined output from in into rows 1.. of batch, skipping the header
+//sets *done at the pending credit table that follows the blocks; returns the batch length including row 0
+int read_mined_batch(FILE *in, ledger_t *batch, long *lineno, int *done) {
+    char line[RECORD_WIDTH + 64];
+    int len = 1;
+
+    while (len <= STREAM_BATCH && NULL != fgets(line, sizeof(line), in)){
+        char *end = line + strcspn(line, "\r\n");
+        (*lineno)++;
+        if (!strncmp(line, "username,pending_credit", 23)){
+            *done = 1;
+            break;
+        }
+        if (end == line || !strncmp(line, "created_at,", 11)){continue;}
+        verify_line[len] = *lineno;
+        verify_status[len] = (unsigned char)parse_mined(line, end, batch, len);
+        len++;
+    }
+    batch->length = len;
+    return len;
+}
+
+//claims VERIFY_CHUNK rows of the batch at a time and rehashes their blocks together, as many per compression as the CPU has lanes
+void * verify_blocks(void * unused) {
+    block_t blocks[VERIFY_CHUNK];
+    uint32_t states[VERIFY_CHUNK][SHA256_WORDS];
+    int rows[VERIFY_CHUNK];
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    long first, k;
+    int n, i;
+
+    while ((first = atomic_fetch_add(&next_row, VERIFY_CHUNK)) < numelems){
+        //the rows that parsed, rebuilt as the exact block_t bytes that were hashed
+        n = 0;
+        for (k = first; k < first + VERIFY_CHUNK && k < numelems; k++){
+            if (verify_status[k] != VERIFY_OK){continue;}
+            build_block(&blocks[n], ledger, k);
+            blocks[n].proof_of_work = claimed_proof[k];
+            rows[n++] = k;
+        }
+        sha256_hash_many(blocks, sizeof(block_t), sizeof(block_t), n, states);
+        for (i=0; i < n; i++){
+            sha256_digest_bytes(states[i], digest);
+            if (memcmp(digest, claimed_digest[rows[i]], SHA256_DIGEST_LENGTH)){
+                verify_status[rows[i]] = VERIFY_DIGEST;
+            }
+            else if (states[i][0] & target_mask){
+                verify_status[rows[i]] = VERIFY_DIFFICULTY;
+            }
+        }
+    }
+    return NULL;
+}
+
+//verify mode: checks every block of the mined output in filename (or stdin) with up to nthreads threads
+//prints the lines that fail and a summary; returns 1 if any block failed or the output can't be read
+int verify_output(const char *filename, pthread_t *thread_array) {
+    FILE *in = is_stream(filename) ? stdin : fopen(filename, "r");
+    ledger_t batch;
+    long lineno = 0, i;
+    uint64_t checked = 0, failed = 0;
+    int done = 0;
+
+    if (!in){
+        fprintf(stderr, "Could not open %s\n", filename);
+        return 1;
+    }
+    claimed_proof = malloc((STREAM_BATCH + 1) * sizeof(uint64_t));
+    claimed_digest = malloc((STREAM_BATCH + 1) * sizeof(*claimed_digest));
+    verify_status = malloc(STREAM_BATCH + 1);
+    verify_line = malloc((STREAM_BATCH + 1) * sizeof(long));
+    if (!claimed_proof || !claimed_digest || !verify_status || !verify_line || alloc_ledger(&batch, STREAM_BATCH + 1)){
+        free(claimed_proof);
+        free(claimed_digest);
+        free(verify_status);
+        free(verify_line);
+        if (in != stdin){fclose(in);}
+        return 1;
+    }
+
+    ledger = &batch;
+    while (!done && (numelems = read_mined_batch(in, &batch, &lineno, &done)) > 1){
+        //enough threads for the batch's chunks, no more
+        nworkers = (numelems - 1 + VERIFY_CHUNK - 1) / VERIFY_CHUNK;
+        if (nworkers > nthreads){
+            nworkers = nthreads;
+        }
+        atomic_store(&next_row, 1);
+        for (i=0; i < nworkers; i++){
+            pthread_create(&thread_array[i], NULL, verify_blocks, NULL);
+        }
+        for (i=0; i < nworkers; i++){
+            pthread_join(thread_array[i], NULL);
+        }
+
+        //reports in line order
+        for (i=1; i < numelems; i++){
+            if (verify_status[i] != VERIFY_OK){
+                printf("line %ld: %s\n", verify_line[i], verify_reasons[verify_status[i]]);
+                failed++;
+            }
+        }
+        checked += numelems - 1;
+    }
+    ledger = NULL;
+    printf("%lu blocks checked, %lu failed\n", (unsigned long)checked, (unsigned long)failed);
+
+    free_ledger(&batch);
+    free(claimed_proof);
+    free(claimed_digest);
+    free(verify_status);
+    free(verify_line);
+    claimed_proof = NULL;
+    claimed_digest = NULL;
+    verify_status = NULL;
+    verify_line = NULL;
+    if (in != stdin){fclose(in);}
+    return failed != 0;
+}
+
+//main is called with two arguments: CSV filename, num threads
+int main(int argc, char *argv[]) {
+
+    //initializing the columns of transactions
+    ledger_t transactions = {0};
+
+    //exit status
+    int status = 0;
+
+    //call help to ensure correct usage
+    //options come out of argv first (argc is 0 if one has a bad value)
+    argc = parse_options(argc, argv, parse_pr4_p_option);
+    if (argc && help(argc, argv) && select_backend()){
+
+        //set number of threads (at least one)
+        nthreads = (argc > 2) ? strtol(argv[2], NULL, 10) : 1;
+        if (nthreads < 1){
+            nthreads = 1;
+        }
+
+        //allocate thread array, and a pending credit table and arena per thread
+        pthread_t *thread_array = malloc(nthreads * sizeof(pthread_t));
+        worker_credit = calloc(nthreads, sizeof(hashtable_t *));
+        worker_arenas = calloc(nthreads, sizeof(arena_t));
+
+        if (!thread_array || !worker_credit || !worker_arenas){
+            fprintf(stderr, "Out of memory for %d threads\n", nthreads);
+            status = 4;
+        }
+        else if (!verify_mode && checkpoint_path && (run_balances || !run_credit)){
+            //the checkpoint only carries pending credit
+            printf("\n--checkpoint needs the credit stage and can't resume balances\n\n");
+            status = 1;
+        }
+        else if (verify_mode){
+            //checks mined output rather than mining
+            status = verify_output(argv[1], thread_array);
+        }
+        else if (checkpoint_path){
+            //mines the rows added to the CSV since the checkpoint
+            status = append_blocks(argv[1], thread_array);
+        }
+        else if (is_stream(argv[1])){
+            //reads transactions from stdin batch by batch
+            if (open_pow_cache(POW_CACHE_STREAM_ROWS)){
+                status = stream_blocks(stdin, thread_array, 0);
+            }
+        }
+        else {
+            //reads through provided CSV, builds the columns of transactions
+            //sets numelems correctly
+            read_transactions(argv[1], &transactions, nthreads);
+            ledger = &transactions;
+            numelems = transactions.length;
+        }
+
+        if (!status && !verify_mode && !checkpoint_path && !is_stream(argv[1]) && open_pow_cache(numelems)){
+
+            if (run_mine){
+                //allocate one output record per row
+                records = malloc((size_t)numelems * RECORD_WIDTH);
+                record_len = malloc(numelems * sizeof(uint16_t));
+            }
+            if (run_mine && (!records || !record_len)){
+                fprintf(stderr, "Out of memory for the output of %d transactions\n", numelems - 1);
+                status = 4;
+            }
+            else {
+                //the balances stage sorts and folds the rows alongside the miners
+                start_balances(ledger);
+
+                //print header
+                if (run_mine){
+                    printf("%s", "created_at,sender,recipient,amount,proof,digest\n");
+                }
+
+                //mines and prints a block for every transaction
+                //adds pending credit for recipients to the account map
+                mine_transactions(thread_array);
+
+                //iterates through, prints content, and frees the account map
+                if (run_credit){
+                    iterate_hashtable();
+                }
+                finish_balances();
+                if (run_balances){
+                    print_balances();
+                }
+            }
+
+            //free output records
+            free(records);
+            free(record_len);
+        }
+
+        //free threads and write the cache back
         free(thread_array);
-        //free output array
-        free(res_arr);
+        free(worker_credit);
+        free(worker_arenas);
+        pow_cache_close();
     }
 
-    //freeing memory used for arr
-    free(arr);
+    //freeing memory used for the transactions and the usernames
+    free_ledger(&transactions);
+    free_names(&usernames);
    
-    return 0;
+    return status;
 }
@@ -0,0 +1,609 @@
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#if defined(SHA256_OPENSSL)
+//the low level interface is the only one that can resume from a midstate
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include <openssl/sha.h>
+#endif
+#include "sha256.h"
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t sha256_init[SHA256_WORDS] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static inline uint32_t load_be32(const unsigned char *p){
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+void sha256_compress(uint32_t state[SHA256_WORDS], const uint32_t block[SHA256_BLOCK_WORDS]){
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+
+    memcpy(w, block, SHA256_BLOCK_BYTES);
+    for (i=16; i < 64; i++){
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = state[0]; b = state[1]; c = state[2]; d = state[3];
+    e = state[4]; f = state[5]; g = state[6]; h = state[7];
+    for (i=0; i < 64; i++){
+        t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+int sha256_midstate_init(sha256_midstate_t *mid, const void *msg, size_t len, size_t nonce_offset){
+    const unsigned char *p = (const unsigned char *)msg;
+    size_t last = len - len % SHA256_BLOCK_BYTES;
+    unsigned char tail[SHA256_BLOCK_BYTES];
+    uint32_t block[SHA256_BLOCK_WORDS];
+    uint64_t bits = (uint64_t)len * 8;
+    int i;
+
+    //the nonce, the 0x80 terminator and the 8 byte length must all land in the last block
+    if (len % SHA256_BLOCK_BYTES > SHA256_BLOCK_BYTES - 9 || nonce_offset < last || nonce_offset + 8 > len || nonce_offset % 4){
+        return 1;
+    }
+
+    memcpy(mid->state, sha256_init, sizeof(sha256_init));
+    for (size_t off = 0; off < last; off += SHA256_BLOCK_BYTES){
+        for (i=0; i < SHA256_BLOCK_WORDS; i++){
+            block[i] = load_be32(p + off + 4 * i);
+        }
+        sha256_compress(mid->state, block);
+    }
+
+    //padding the last block once; only the nonce words change per attempt
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, p + last, len - last);
+    tail[len - last] = 0x80;
+    for (i=0; i < 8; i++){
+        tail[SHA256_BLOCK_BYTES - 1 - i] = (unsigned char)(bits >> (8 * i));
+    }
+    for (i=0; i < SHA256_BLOCK_WORDS; i++){
+        mid->tail[i] = load_be32(tail + 4 * i);
+    }
+    mid->prefix_bytes = last;
+    mid->tail_bytes = (int)(len - last);
+    mid->nonce_word = (int)(nonce_offset - last) / 4;
+    mid->tail[mid->nonce_word] = 0;
+    mid->tail[mid->nonce_word + 1] = 0;
+    return 0;
+}
+
+//fills in the last block of the message with nonce in place
+static inline void midstate_block(const sha256_midstate_t *mid, uint64_t nonce, uint32_t block[SHA256_BLOCK_WORDS]){
+    unsigned char bytes[8];
+
+    //the nonce is hashed the way it sits in memory inside the block
+    memcpy(bytes, &nonce, sizeof(bytes));
+    memcpy(block, mid->tail, SHA256_BLOCK_BYTES);
+    block[mid->nonce_word] = load_be32(bytes);
+    block[mid->nonce_word + 1] = load_be32(bytes + 4);
+}
+
+void sha256_midstate_hash(const sha256_midstate_t *mid, uint64_t nonce, uint32_t out[SHA256_WORDS]){
+    uint32_t block[SHA256_BLOCK_WORDS];
+
+    midstate_block(mid, nonce, block);
+    memcpy(out, mid->state, SHA256_WORDS * sizeof(uint32_t));
+    sha256_compress(out, block);
+}
+
+void sha256_digest_bytes(const uint32_t state[SHA256_WORDS], unsigned char *digest){
+    int i;
+    for (i=0; i < SHA256_WORDS; i++){
+        digest[4 * i] = (unsigned char)(state[i] >> 24);
+        digest[4 * i + 1] = (unsigned char)(state[i] >> 16);
+        digest[4 * i + 2] = (unsigned char)(state[i] >> 8);
+        digest[4 * i + 3] = (unsigned char)state[i];
+    }
+}
+
+//number of 64 byte blocks a len byte message takes once padded
+static inline size_t padded_blocks(size_t len){
+    return (len + 9 + SHA256_BLOCK_BYTES - 1) / SHA256_BLOCK_BYTES;
+}
+
+//lays out block b of the padded len byte message msg as big endian words
+static void padded_block(const unsigned char *msg, size_t len, size_t b, uint32_t block[SHA256_BLOCK_WORDS]){
+    unsigned char bytes[SHA256_BLOCK_BYTES];
+    size_t off = b * SHA256_BLOCK_BYTES;
+    uint64_t bits = (uint64_t)len * 8;
+    int i;
+
+    memset(bytes, 0, sizeof(bytes));
+    if (off < len){
+        memcpy(bytes, msg + off, len - off < SHA256_BLOCK_BYTES ? len - off : SHA256_BLOCK_BYTES);
+    }
+    if (len >= off && len - off < SHA256_BLOCK_BYTES){
+        bytes[len - off] = 0x80;
+    }
+    if (b == padded_blocks(len) - 1){
+        for (i=0; i < 8; i++){
+            bytes[SHA256_BLOCK_BYTES - 1 - i] = (unsigned char)(bits >> (8 * i));
+        }
+    }
+    for (i=0; i < SHA256_BLOCK_WORDS; i++){
+        block[i] = load_be32(bytes + 4 * i);
+    }
+}
+
+//one message at a time
+static void sha256_hash_many_scalar(const unsigned char *msgs, size_t len, size_t stride, size_t n, uint32_t (*out)[SHA256_WORDS]){
+    uint32_t block[SHA256_BLOCK_WORDS];
+    size_t m, b;
+    for (m = 0; m < n; m++){
+        memcpy(out[m], sha256_init, sizeof(sha256_init));
+        for (b = 0; b < padded_blocks(len); b++){
+            padded_block(msgs + m * stride, len, b, block);
+            sha256_compress(out[m], block);
+        }
+    }
+}
+
+int sha256_search_scalar(const sha256_midstate_t *mid, uint64_t start, uint64_t count, uint32_t mask, uint64_t *nonce){
+    uint32_t state[SHA256_WORDS];
+    uint64_t i;
+    for (i=0; i < count; i++){
+        sha256_midstate_hash(mid, start + i, state);
+        if (!(state[0] & mask)){
+            *nonce = start + i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#if defined(__x86_64__)
+//the multi-buffer kernels hash one message per 32 bit lane; the round function is the scalar one written with vector ops
+//the nonce words are byte swapped per lane, since x86 keeps the nonce little endian in the block
+#define SHA256_ROUNDS_X(VEC, ADD, XOR, AND, ANDNOT, OR, ROR, SHR, SET1, S, W) do { \
+    VEC w_[64]; \
+    VEC a_, b_, c_, d_, e_, f_, g_, h_, t1_, t2_; \
+    int r_; \
+    for (r_=0; r_ < 16; r_++){w_[r_] = (W)[r_];} \
+    for (r_=16; r_ < 64; r_++){ \
+        VEC s0_ = XOR(XOR(ROR(w_[r_ - 15], 7), ROR(w_[r_ - 15], 18)), SHR(w_[r_ - 15], 3)); \
+        VEC s1_ = XOR(XOR(ROR(w_[r_ - 2], 17), ROR(w_[r_ - 2], 19)), SHR(w_[r_ - 2], 10)); \
+        w_[r_] = ADD(ADD(w_[r_ - 16], s0_), ADD(w_[r_ - 7], s1_)); \
+    } \
+    a_ = (S)[0]; b_ = (S)[1]; c_ = (S)[2]; d_ = (S)[3]; \
+    e_ = (S)[4]; f_ = (S)[5]; g_ = (S)[6]; h_ = (S)[7]; \
+    for (r_=0; r_ < 64; r_++){ \
+        t1_ = ADD(ADD(h_, XOR(XOR(ROR(e_, 6), ROR(e_, 11)), ROR(e_, 25))), \
+                  ADD(XOR(AND(e_, f_), ANDNOT(e_, g_)), ADD(SET1((int)sha256_k[r_]), w_[r_]))); \
+        t2_ = ADD(XOR(XOR(ROR(a_, 2), ROR(a_, 13)), ROR(a_, 22)), XOR(XOR(AND(a_, b_), AND(a_, c_)), AND(b_, c_))); \
+        h_ = g_; g_ = f_; f_ = e_; e_ = ADD(d_, t1_); \
+        d_ = c_; c_ = b_; b_ = a_; a_ = ADD(t1_, t2_); \
+    } \
+    (S)[0] = ADD((S)[0], a_); (S)[1] = ADD((S)[1], b_); (S)[2] = ADD((S)[2], c_); (S)[3] = ADD((S)[3], d_); \
+    (S)[4] = ADD((S)[4], e_); (S)[5] = ADD((S)[5], f_); (S)[6] = ADD((S)[6], g_); (S)[7] = ADD((S)[7], h_); \
+} while (0)
+
+#define AVX2_ROR(x, n) _mm256_or_si256(_mm256_srli_epi32((x), (n)), _mm256_slli_epi32((x), 32 - (n)))
+
+//one compression of 8 independent blocks, lane i of every word belonging to block i
+__attribute__((target("avx2")))
+static void sha256_compress_x8(__m256i state[SHA256_WORDS], const __m256i block[SHA256_BLOCK_WORDS]){
+    SHA256_ROUNDS_X(__m256i, _mm256_add_epi32, _mm256_xor_si256, _mm256_and_si256, _mm256_andnot_si256, _mm256_or_si256,
+                    AVX2_ROR, _mm256_srli_epi32, _mm256_set1_epi32, state, block);
+}
+
+__attribute__((target("avx2")))
+int sha256_search_avx2(const sha256_midstate_t *mid, uint64_t start, uint64_t count, uint32_t mask, uint64_t *nonce){
+    const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                           3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m256i maskv = _mm256_set1_epi32((int)mask);
+    __m256i block[SHA256_BLOCK_WORDS], state[SHA256_WORDS];
+    uint32_t lo[8], hi[8];
+    uint64_t done;
+    int i;
+
+    for (i=0; i < SHA256_BLOCK_WORDS; i++){
+        block[i] = _mm256_set1_epi32((int)mid->tail[i]);
+    }
+    for (done = 0; done < count; done += 8){
+        uint64_t base = start + done;
+        for (i=0; i < 8; i++){
+            lo[i] = (uint32_t)(base + i);
+            hi[i] = (uint32_t)((base + i) >> 32);
+        }
+        block[mid->nonce_word] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)lo), bswap);
+        block[mid->nonce_word + 1] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)hi), bswap);
+        for (i=0; i < SHA256_WORDS; i++){
+            state[i] = _mm256_set1_epi32((int)mid->state[i]);
+        }
+        sha256_compress_x8(state, block);
+
+        //one bit per lane whose first word clears the mask; lanes past count don't count
+        unsigned hits = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(
+            _mm256_cmpeq_epi32(_mm256_and_si256(state[0], maskv), _mm256_setzero_si256())));
+        if (count - done < 8){
+            hits &= (1u << (count - done)) - 1;
+        }
+        if (hits){
+            *nonce = base + __builtin_ctz(hits);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//8 messages per compression, one per lane; lanes past n repeat the last message
+__attribute__((target("avx2")))
+static void sha256_hash_many_avx2(const unsigned char *msgs, size_t len, size_t stride, size_t n, uint32_t (*out)[SHA256_WORDS]){
+    __m256i block[SHA256_BLOCK_WORDS], state[SHA256_WORDS];
+    uint32_t words[SHA256_BLOCK_WORDS][8], lane[SHA256_BLOCK_WORDS], digest[SHA256_WORDS][8];
+    size_t group, b, m;
+    int i, j;
+
+    for (group = 0; group < n; group += 8){
+        for (i=0; i < SHA256_WORDS; i++){
+            state[i] = _mm256_set1_epi32((int)sha256_init[i]);
+        }
+        for (b = 0; b < padded_blocks(len); b++){
+            for (j=0; j < 8; j++){
+                m = group + j < n ? group + j : n - 1;
+                padded_block(msgs + m * stride, len, b, lane);
+                for (i=0; i < SHA256_BLOCK_WORDS; i++){
+                    words[i][j] = lane[i];
+                }
+            }
+            for (i=0; i < SHA256_BLOCK_WORDS; i++){
+                block[i] = _mm256_loadu_si256((const __m256i *)words[i]);
+            }
+            sha256_compress_x8(state, block);
+        }
+        for (i=0; i < SHA256_WORDS; i++){
+            _mm256_storeu_si256((__m256i *)digest[i], state[i]);
+        }
+        for (j=0; j < 8 && group + j < n; j++){
+            for (i=0; i < SHA256_WORDS; i++){
+                out[group + j][i] = digest[i][j];
+            }
+        }
+    }
+}
+
+#define AVX512_ROR(x, n) _mm512_ror_epi32((x), (n))
+
+//one compression of 16 independent blocks
+__attribute__((target("avx512f")))
+static void sha256_compress_x16(__m512i state[SHA256_WORDS], const __m512i block[SHA256_BLOCK_WORDS]){
+    SHA256_ROUNDS_X(__m512i, _mm512_add_epi32, _mm512_xor_si512, _mm512_and_si512, _mm512_andnot_si512, _mm512_or_si512,
+                    AVX512_ROR, _mm512_srli_epi32, _mm512_set1_epi32, state, block);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+int sha256_search_avx512(const sha256_midstate_t *mid, uint64_t start, uint64_t count, uint32_t mask, uint64_t *nonce){
+    const __m512i bswap = _mm512_set4_epi32(0x0c0d0e0f, 0x08090a0b, 0x04050607, 0x00010203);
+    const __m512i maskv = _mm512_set1_epi32((int)mask);
+    __m512i block[SHA256_BLOCK_WORDS], state[SHA256_WORDS];
+    uint32_t lo[16], hi[16];
+    uint64_t done;
+    int i;
+
+    for (i=0; i < SHA256_BLOCK_WORDS; i++){
+        block[i] = _mm512_set1_epi32((int)mid->tail[i]);
+    }
+    for (done = 0; done < count; done += 16){
+        uint64_t base = start + done;
+        for (i=0; i < 16; i++){
+            lo[i] = (uint32_t)(base + i);
+            hi[i] = (uint32_t)((base + i) >> 32);
+        }
+        block[mid->nonce_word] = _mm512_shuffle_epi8(_mm512_loadu_si512(lo), bswap);
+        block[mid->nonce_word + 1] = _mm512_shuffle_epi8(_mm512_loadu_si512(hi), bswap);
+        for (i=0; i < SHA256_WORDS; i++){
+            state[i] = _mm512_set1_epi32((int)mid->state[i]);
+        }
+        sha256_compress_x16(state, block);
+
+        unsigned hits = (unsigned)_mm512_testn_epi32_mask(state[0], maskv);
+        if (count - done < 16){
+            hits &= (1u << (count - done)) - 1;
+        }
+        if (hits){
+            *nonce = base + __builtin_ctz(hits);
+            return 1;
+        }
+    }
+    return 0;
+}
+//16 messages per compression with AVX-512; lanes past n repeat the last message
+__attribute__((target("avx512f")))
+static void sha256_hash_many_avx512(const unsigned char *msgs, size_t len, size_t stride, size_t n, uint32_t (*out)[SHA256_WORDS]){
+    __m512i block[SHA256_BLOCK_WORDS], state[SHA256_WORDS];
+    uint32_t words[SHA256_BLOCK_WORDS][16], lane[SHA256_BLOCK_WORDS], digest[SHA256_WORDS][16];
+    size_t group, b, m;
+    int i, j;
+
+    for (group = 0; group < n; group += 16){
+        for (i=0; i < SHA256_WORDS; i++){
+            state[i] = _mm512_set1_epi32((int)sha256_init[i]);
+        }
+        for (b = 0; b < padded_blocks(len); b++){
+            for (j=0; j < 16; j++){
+                m = group + j < n ? group + j : n - 1;
+                padded_block(msgs + m * stride, len, b, lane);
+                for (i=0; i < SHA256_BLOCK_WORDS; i++){
+                    words[i][j] = lane[i];
+                }
+            }
+            for (i=0; i < SHA256_BLOCK_WORDS; i++){
+                block[i] = _mm512_loadu_si512(words[i]);
+            }
+            sha256_compress_x16(state, block);
+        }
+        for (i=0; i < SHA256_WORDS; i++){
+            _mm512_storeu_si512(digest[i], state[i]);
+        }
+        for (j=0; j < 16 && group + j < n; j++){
+            for (i=0; i < SHA256_WORDS; i++){
+                out[group + j][i] = digest[i][j];
+            }
+        }
+    }
+}
+#endif
+
+#if defined(__x86_64__)
+//rounds of one block with the SHA extensions; state is kept as the ABEF/CDGH pair the instructions work on
+__attribute__((target("sha,sse4.1")))
+static inline void shani_rounds(__m128i *abef, __m128i *cdgh, const uint32_t block[SHA256_BLOCK_WORDS]){
+    __m128i msg[4], m, s0 = *abef, s1 = *cdgh;
+    int g;
+
+    for (g=0; g < 16; g++){
+        if (g < 4){
+            msg[g] = _mm_loadu_si128((const __m128i *)(block + 4 * g));
+        }
+        else {
+            //w[t..t+3] from w[t-16..t-1], kept in a ring of four
+            __m128i w7 = _mm_alignr_epi8(msg[(g - 1) & 3], msg[(g - 2) & 3], 4);
+            msg[g & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(msg[g & 3], msg[(g - 3) & 3]), w7), msg[(g - 1) & 3]);
+        }
+        m = _mm_add_epi32(msg[g & 3], _mm_loadu_si128((const __m128i *)(sha256_k + 4 * g)));
+        s1 = _mm_sha256rnds2_epu32(s1, s0, m);
+        s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(m, 0x0e));
+    }
+    *abef = _mm_add_epi32(*abef, s0);
+    *cdgh = _mm_add_epi32(*cdgh, s1);
+}
+
+//two nonces per iteration, so the two dependency chains of rounds overlap
+__attribute__((target("sha,sse4.1")))
+int sha256_search_shani(const sha256_midstate_t *mid, uint64_t start, uint64_t count, uint32_t mask, uint64_t *nonce){
+    uint32_t block0[SHA256_BLOCK_WORDS], block1[SHA256_BLOCK_WORDS];
+    __m128i dcba = _mm_loadu_si128((const __m128i *)mid->state);
+    __m128i hgfe = _mm_loadu_si128((const __m128i *)(mid->state + 4));
+    __m128i cdab = _mm_shuffle_epi32(dcba, 0xb1);
+    __m128i efgh = _mm_shuffle_epi32(hgfe, 0x1b);
+    const __m128i abef = _mm_alignr_epi8(cdab, efgh, 8);
+    const __m128i cdgh = _mm_blend_epi16(efgh, cdab, 0xf0);
+    uint64_t i;
+
+    for (i=0; i < count; i += 2){
+        __m128i abef0 = abef, cdgh0 = cdgh, abef1 = abef, cdgh1 = cdgh;
+        midstate_block(mid, start + i, block0);
+        midstate_block(mid, start + i + 1, block1);
+        shani_rounds(&abef0, &cdgh0, block0);
+        shani_rounds(&abef1, &cdgh1, block1);
+        //the first digest word is A, the top lane of ABEF
+        if (!((uint32_t)_mm_extract_epi32(abef0, 3) & mask)){
+            *nonce = start + i;
+            return 1;
+        }
+        if (count - i > 1 && !((uint32_t)_mm_extract_epi32(abef1, 3) & mask)){
+            *nonce = start + i + 1;
+            return 1;
+        }
+    }
+    return 0;
+}
+#endif
+
+#if defined(__aarch64__)
+//rounds of one block with the ARMv8 SHA2 instructions
+__attribute__((target("+crypto")))
+static inline void armv8_rounds(uint32x4_t *abcd, uint32x4_t *efgh, const uint32_t block[SHA256_BLOCK_WORDS]){
+    uint32x4_t msg[4], m, s0 = *abcd, s1 = *efgh, save;
+    int g;
+
+    for (g=0; g < 16; g++){
+        if (g < 4){
+            msg[g] = vld1q_u32(block + 4 * g);
+        }
+        else {
+            msg[g & 3] = vsha256su1q_u32(vsha256su0q_u32(msg[g & 3], msg[(g - 3) & 3]), msg[(g - 2) & 3], msg[(g - 1) & 3]);
+        }
+        m = vaddq_u32(msg[g & 3], vld1q_u32(sha256_k + 4 * g));
+        save = s0;
+        s0 = vsha256hq_u32(s0, s1, m);
+        s1 = vsha256h2q_u32(s1, save, m);
+    }
+    *abcd = vaddq_u32(*abcd, s0);
+    *efgh = vaddq_u32(*efgh, s1);
+}
+
+__attribute__((target("+crypto")))
+int sha256_search_armv8(const sha256_midstate_t *mid, uint64_t start, uint64_t count, uint32_t mask, uint64_t *nonce){
+    uint32_t block[SHA256_BLOCK_WORDS];
+    const uint32x4_t abcd = vld1q_u32(mid->state), efgh = vld1q_u32(mid->state + 4);
+    uint64_t i;
+
+    for (i=0; i < count; i++){
+        uint32x4_t s0 = abcd, s1 = efgh;
+        midstate_block(mid, start + i, block);
+        armv8_rounds(&s0, &s1, block);
+        if (!(vgetq_lane_u32(s0, 0) & mask)){
+            *nonce = start + i;
+            return 1;
+        }
+    }
+    return 0;
+}
+#endif
+
+#if defined(SHA256_OPENSSL)
+//resumes an OpenSSL context from the midstate and hashes the last bytes of the message per nonce
+int sha256_search_openssl(const sha256_midstate_t *mid, uint64_t start, uint64_t count, uint32_t mask, uint64_t *nonce){
+    unsigned char tail[SHA256_BLOCK_BYTES], digest[32];
+    uint32_t block[SHA256_BLOCK_WORDS];
+    SHA256_CTX base, ctx;
+    uint64_t i;
+    int j;
+
+    memset(&base, 0, sizeof(base));
+    SHA256_Init(&base);
+    memcpy(base.h, mid->state, sizeof(mid->state));
+    base.Nl = (SHA_LONG)(mid->prefix_bytes * 8);
+    base.Nh = (SHA_LONG)((uint64_t)mid->prefix_bytes * 8 >> 32);
+
+    for (i=0; i < count; i++){
+        midstate_block(mid, start + i, block);
+        for (j=0; j < SHA256_BLOCK_WORDS; j++){
+            tail[4 * j] = (unsigned char)(block[j] >> 24);
+            tail[4 * j + 1] = (unsigned char)(block[j] >> 16);
+            tail[4 * j + 2] = (unsigned char)(block[j] >> 8);
+            tail[4 * j + 3] = (unsigned char)block[j];
+        }
+        ctx = base;
+        SHA256_Update(&ctx, tail, mid->tail_bytes);
+        SHA256_Final(digest, &ctx);
+        if (!(load_be32(digest) & mask)){
+            *nonce = start + i;
+            return 1;
+        }
+    }
+    return 0;
+}
+#endif
+
+#if defined(__x86_64__)
+//checks cpuid leaf 7 for the SHA extensions
+static int has_shani(void){
+    unsigned int eax, ebx, ecx, edx;
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("sse4.1") || !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)){return 0;}
+    return (ebx & bit_SHA) != 0;
+}
+
+static int has_avx512(void){
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+}
+
+static int has_avx2(void){
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+#if defined(__aarch64__)
+//checks the auxiliary vector for the ARMv8 SHA2 instructions
+static int has_armv8_sha2(void){
+    return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+}
+#endif
+
+static int always(void){
+    return 1;
+}
+
+/**
+ * @brief Represents a way of searching nonces and how to tell whether this machine can run it.
+ *
+ * @param name The name accepted by --hash-backend.
+ * @param search The search kernel, NULL if it isn't built for this architecture.
+ * @param supported Checks the CPU for the instructions the kernel needs.
+ */
+typedef struct sha256_backend_t {
+    const char *name;
+    sha256_search_fn search;
+    int (*supported)(void);
+} sha256_backend_t;
+
+//in order of preference
+static const sha256_backend_t sha256_backends[] = {
+#if defined(__x86_64__)
+    {"avx512", sha256_search_avx512, has_avx512},
+    {"sha-ni", sha256_search_shani, has_shani},
+    {"avx2", sha256_search_avx2, has_avx2},
+#endif
+#if defined(__aarch64__)
+    {"armv8", sha256_search_armv8, has_armv8_sha2},
+#endif
+#if defined(SHA256_OPENSSL)
+    {"openssl", sha256_search_openssl, always},
+#endif
+    {"scalar", sha256_search_scalar, always}
+};
+
+#define NUM_BACKENDS (sizeof(sha256_backends) / sizeof(sha256_backends[0]))
+
+sha256_search_fn sha256_select_search(const char *name, const char **chosen){
+    size_t i;
+    for (i=0; i < NUM_BACKENDS; i++){
+        if ((!name || !strcmp(name, sha256_backends[i].name)) && sha256_backends[i].supported()){
+            if (chosen){*chosen = sha256_backends[i].name;}
+            return sha256_backends[i].search;
+        }
+    }
+    return NULL;
+}
+
+void sha256_print_backends(FILE *out){
+    size_t i;
+    for (i=0; i < NUM_BACKENDS; i++){
+        fprintf(out, "%s%s%s", i ? ", " : "", sha256_backends[i].name, sha256_backends[i].supported() ? "" : " (unsupported)");
+    }
+}
+
+const char *sha256_backend_name(size_t i){
+    return (i < NUM_BACKENDS) ? sha256_backends[i].name : NULL;
+}
+
+void sha256_hash_many(const void *msgs, size_t len, size_t stride, size_t n, uint32_t (*out)[SHA256_WORDS]){
+    if (!n){return;}
+#if defined(__x86_64__)
+    if (has_avx512()){
+        sha256_hash_many_avx512(msgs, len, stride, n, out);
+        return;
+    }
+    if (has_avx2()){
+        sha256_hash_many_avx2(msgs, len, stride, n, out);
+        return;
+    }
+#endif
+    sha256_hash_many_scalar(msgs, len, stride, n, out);
+}
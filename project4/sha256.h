@@ -0,0 +1,82 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_WORDS 8
+#define SHA256_BLOCK_WORDS 16
+#define SHA256_BLOCK_BYTES 64
+
+//mask of the first digest word's bits that must be zero for a digest to start with bits zero bits (1 to 32)
+#define SHA256_DIFFICULTY_MASK(bits) (0xffffffffu << (32 - (bits)))
+
+/**
+ * @brief Represents a message whose only changing part is an 8 byte nonce in its last 64 byte block.
+ *
+ * @param state The hash state after every block before the last one; computed once per message.
+ * @param tail The last block as big endian words, padding and bit length included, nonce words left zero.
+ * @param prefix_bytes Length of the message before the last block.
+ * @param tail_bytes Length of the message inside the last block.
+ * @param nonce_word Index in tail of the first of the two words holding the nonce.
+ */
+typedef struct sha256_midstate_t {
+    uint32_t state[SHA256_WORDS];
+    uint32_t tail[SHA256_BLOCK_WORDS];
+    size_t prefix_bytes;
+    int tail_bytes;
+    int nonce_word;
+} sha256_midstate_t;
+
+//runs the compression function on one block of big endian words
+void sha256_compress(uint32_t state[SHA256_WORDS], const uint32_t block[SHA256_BLOCK_WORDS]);
+
+//hashes the len bytes before the last block of msg and lays out the last block around the nonce at nonce_offset
+//returns 1 if the nonce isn't 4 byte aligned inside the last block or the padding doesn't fit in that block
+int sha256_midstate_init(sha256_midstate_t *mid, const void *msg, size_t len, size_t nonce_offset);
+
+//hashes the message with nonce in place, leaving the digest as big endian words in out
+void sha256_midstate_hash(const sha256_midstate_t *mid, uint64_t nonce, uint32_t out[SHA256_WORDS]);
+
+//writes the digest words out as the 32 byte digest
+void sha256_digest_bytes(const uint32_t state[SHA256_WORDS], unsigned char *digest);
+
+//hashes n messages of len bytes each, laid out stride bytes apart, leaving the digest words of message i in out[i]
+//the messages share each compression across the lanes of the widest multi-buffer kernel the CPU runs
+void sha256_hash_many(const void *msgs, size_t len, size_t stride, size_t n, uint32_t (*out)[SHA256_WORDS]);
+
+//searches nonces [start, start + count) for the lowest one whose first digest word has no bit of mask set
+//returns 1 and sets *nonce if one is found, 0 otherwise
+typedef int (*sha256_search_fn)(const sha256_midstate_t *mid, uint64_t start, uint64_t count, uint32_t mask, uint64_t *nonce);
+
+//one nonce at a time, portable C
+int sha256_search_scalar(const sha256_midstate_t *mid, uint64_t start, uint64_t count, uint32_t mask, uint64_t *nonce);
+#if defined(__x86_64__)
+//8 consecutive nonces per compression, one per 32 bit lane of an AVX2 register
+int sha256_search_avx2(const sha256_midstate_t *mid, uint64_t start, uint64_t count, uint32_t mask, uint64_t *nonce);
+//16 consecutive nonces per compression with AVX-512
+int sha256_search_avx512(const sha256_midstate_t *mid, uint64_t start, uint64_t count, uint32_t mask, uint64_t *nonce);
+//one nonce per compression with the SHA extensions (SHA-NI)
+int sha256_search_shani(const sha256_midstate_t *mid, uint64_t start, uint64_t count, uint32_t mask, uint64_t *nonce);
+#endif
+#if defined(__aarch64__)
+//one nonce per compression with the ARMv8 SHA2 instructions
+int sha256_search_armv8(const sha256_midstate_t *mid, uint64_t start, uint64_t count, uint32_t mask, uint64_t *nonce);
+#endif
+#if defined(SHA256_OPENSSL)
+//one nonce per call into OpenSSL, resumed from the midstate
+int sha256_search_openssl(const sha256_midstate_t *mid, uint64_t start, uint64_t count, uint32_t mask, uint64_t *nonce);
+#endif
+
+//returns the search of the backend called name, or of the preferred one this CPU supports if name is NULL
+//returns NULL if name is unknown or the CPU can't run it; *chosen (if not NULL) is set to the backend's name
+sha256_search_fn sha256_select_search(const char *name, const char **chosen);
+
+//lists the backend names, marking the ones this CPU can't run
+void sha256_print_backends(FILE *out);
+
+//name of the i-th backend in order of preference, NULL past the last one
+const char *sha256_backend_name(size_t i);
+
+#endif
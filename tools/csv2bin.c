@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../common/ledger.h"
+
+/**
+ * @brief Represents the username dictionary while converting.
+ * 
+ * @param slots Open addressing table of dictionary index + 1 (0 is an empty slot).
+ * @param cap Number of slots, always a power of two.
+ * @param count Number of distinct names.
+ * @param names Start of every name, pointing into the mapped CSV.
+ * @param lens Length of every name.
+ * @param names_cap Capacity of names and lens.
+ */
+typedef struct name_table_t {
+    uint32_t *slots;
+    size_t cap;
+    uint32_t count;
+    const char **names;
+    uint32_t *lens;
+    size_t names_cap;
+} name_table_t;
+
+//returns the dictionary index of name, adding it if it is new; UINT32_MAX if out of memory
+//names are kept whole, pointing into the CSV; readers truncate them when they intern them
+uint32_t add_name(name_table_t *table, const char *name, size_t len) {
+    size_t i, mask;
+
+    //grow the table at half load
+    if (2 * ((size_t)table->count + 1) > table->cap){
+        size_t newcap = table->cap ? table->cap * 2 : 1024;
+        uint32_t *slots = calloc(newcap, sizeof(uint32_t));
+        if (!slots){return UINT32_MAX;}
+        for (i = 0; i < table->cap; i++){
+            uint32_t id = table->slots[i];
+            if (!id){continue;}
+            size_t j = hash_name(table->names[id - 1], table->lens[id - 1]) & (newcap - 1);
+            while (slots[j]){j = (j + 1) & (newcap - 1);}
+            slots[j] = id;
+        }
+        free(table->slots);
+        table->slots = slots;
+        table->cap = newcap;
+    }
+
+    //probe for the name
+    mask = table->cap - 1;
+    for (i = hash_name(name, len) & mask; table->slots[i]; i = (i + 1) & mask){
+        uint32_t id = table->slots[i] - 1;
+        if (table->lens[id] == len && !memcmp(table->names[id], name, len)){return id;}
+    }
+
+    //add it
+    if (table->count == table->names_cap){
+        size_t newcap = table->names_cap ? table->names_cap * 2 : 1024;
+        const char **names = realloc(table->names, newcap * sizeof(char *));
+        if (!names){return UINT32_MAX;}
+        table->names = names;
+        uint32_t *lens = realloc(table->lens, newcap * sizeof(uint32_t));
+        if (!lens){return UINT32_MAX;}
+        table->lens = lens;
+        table->names_cap = newcap;
+    }
+    table->names[table->count] = name;
+    table->lens[table->count] = (uint32_t)len;
+    table->slots[i] = ++table->count;
+    return table->count - 1;
+}
+
+//writes count 32 bit values in little-endian order
+int write_u32s(FILE *out, const uint32_t *values, size_t count) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return fwrite(values, sizeof(uint32_t), count, out) != count;
+#else
+    size_t i;
+    for (i = 0; i < count; i++){
+        uint32_t v = htole32(values[i]);
+        if (fwrite(&v, sizeof(v), 1, out) != 1){return 1;}
+    }
+    return 0;
+#endif
+}
+
+//writes count 64 bit values in little-endian order
+int write_u64s(FILE *out, const uint64_t *values, size_t count) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return fwrite(values, sizeof(uint64_t), count, out) != count;
+#else
+    size_t i;
+    for (i = 0; i < count; i++){
+        uint64_t v = htole64(values[i]);
+        if (fwrite(&v, sizeof(v), 1, out) != 1){return 1;}
+    }
+    return 0;
+#endif
+}
+
+//pads the file with zeros up to the next multiple of 8 bytes
+int write_padding(FILE *out, uint64_t *pos) {
+    static const char zeros[8] = {0};
+    size_t pad = (8 - (*pos & 7)) & 7;
+    *pos += pad;
+    return fwrite(zeros, 1, pad, out) != pad;
+}
+
+//converts a CSV ledger (created_at,sender,recipient,amount with a header row) into the binary columnar format
+int csv2bin(const char *inname, const char *outname) {
+    int fd = open(inname, O_RDONLY);
+    if (fd < 0){return 2;}
+
+    struct stat st;
+    if (fstat(fd, &st) < 0){
+        close(fd);
+        return 2;
+    }
+    size_t size = (size_t)st.st_size;
+
+    //map the file; an empty file is converted to an empty ledger
+    const char *map = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (map == MAP_FAILED){return 3;}
+
+    const char *end = map + size, *p, *nl;
+
+    //count the data rows (the first line is the header)
+    uint64_t num_rows = 0;
+    for (p = map; p < end && (nl = memchr(p, '\n', end - p)); p = nl + 1){
+        num_rows ++;
+    }
+    if (p < end){num_rows ++;}
+    if (num_rows){num_rows --;}
+
+    //column buffers
+    uint64_t *created_at = malloc(num_rows * sizeof(uint64_t) + 1);
+    uint32_t *sender = malloc(num_rows * sizeof(uint32_t) + 1);
+    uint32_t *recipient = malloc(num_rows * sizeof(uint32_t) + 1);
+    uint64_t *amount = malloc(num_rows * sizeof(uint64_t) + 1);
+    name_table_t table = {0};
+    int status = 0;
+    if (!created_at || !sender || !recipient || !amount){status = 4;}
+
+    //skip the header, then split every line into its four fields
+    p = map;
+    if (p && (nl = memchr(p, '\n', end - p))){p = nl + 1;}
+    else {p = end;}
+    uint64_t row;
+    for (row = 0; !status && row < num_rows; row++){
+        const char *field[4] = {p, end, end, end}, *fend[4] = {end, end, end, end}, *comma;
+        int f = 0;
+
+        nl = memchr(p, '\n', end - p);
+        if (!nl){nl = end;}
+        fend[0] = nl;
+        while (f < 3 && (comma = memchr(field[f], ',', nl - field[f]))){
+            fend[f] = comma;
+            field[++f] = comma + 1;
+            fend[f] = nl;
+        }
+
+        //missing fields are empty, same as the programs' CSV readers
+        created_at[row] = (uint64_t)parse_number(field[0], fend[0]);
+        sender[row] = add_name(&table, f >= 1 ? field[1] : nl, f >= 1 ? fend[1] - field[1] : 0);
+        recipient[row] = add_name(&table, f >= 2 ? field[2] : nl, f >= 2 ? fend[2] - field[2] : 0);
+        amount[row] = f >= 3 ? (uint64_t)parse_number(field[3], fend[3]) : 0;
+        if (sender[row] == UINT32_MAX || recipient[row] == UINT32_MAX){status = 4;}
+
+        p = nl + 1;
+    }
+
+    FILE *out = status ? NULL : fopen(outname, "wb");
+    if (!status && !out){status = 5;}
+
+    if (!status){
+        //lay out the sections, each one 8 byte aligned
+        ledger_header_t header;
+        uint64_t blob_len = 0, pos;
+        uint32_t i;
+        uint32_t *name_end = malloc((size_t)table.count * sizeof(uint32_t) + 1);
+        if (!name_end){status = 4;}
+        for (i = 0; !status && i < table.count; i++){
+            blob_len += table.lens[i];
+            name_end[i] = (uint32_t)blob_len;
+        }
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, LEDGER_MAGIC, 8);
+        header.version = htole32(LEDGER_VERSION);
+        header.num_names = htole32(table.count);
+        header.num_rows = htole64(num_rows);
+        pos = sizeof(ledger_header_t);
+        header.names_offset = htole64(pos);
+        pos += (uint64_t)table.count * sizeof(uint32_t) + blob_len;
+        pos = (pos + 7) & ~(uint64_t)7;
+        header.created_at_offset = htole64(pos);
+        pos += num_rows * sizeof(uint64_t);
+        header.sender_offset = htole64(pos);
+        pos += num_rows * sizeof(uint32_t);
+        pos = (pos + 7) & ~(uint64_t)7;
+        header.recipient_offset = htole64(pos);
+        pos += num_rows * sizeof(uint32_t);
+        pos = (pos + 7) & ~(uint64_t)7;
+        header.amount_offset = htole64(pos);
+
+        //write the header, dictionary and columns in the order laid out above
+        pos = sizeof(ledger_header_t);
+        if (!status && fwrite(&header, sizeof(header), 1, out) != 1){status = 5;}
+        if (!status && write_u32s(out, name_end, table.count)){status = 5;}
+        for (i = 0; !status && i < table.count; i++){
+            if (fwrite(table.names[i], 1, table.lens[i], out) != table.lens[i]){status = 5;}
+        }
+        pos += (uint64_t)table.count * sizeof(uint32_t) + blob_len;
+        if (!status && write_padding(out, &pos)){status = 5;}
+        if (!status && write_u64s(out, created_at, num_rows)){status = 5;}
+        if (!status && write_u32s(out, sender, num_rows)){status = 5;}
+        pos += num_rows * (sizeof(uint64_t) + sizeof(uint32_t));
+        if (!status && write_padding(out, &pos)){status = 5;}
+        if (!status && write_u32s(out, recipient, num_rows)){status = 5;}
+        pos += num_rows * sizeof(uint32_t);
+        if (!status && write_padding(out, &pos)){status = 5;}
+        if (!status && write_u64s(out, amount, num_rows)){status = 5;}
+        if (fclose(out) && !status){status = 5;}
+        free(name_end);
+    }
+
+    free(created_at);
+    free(sender);
+    free(recipient);
+    free(amount);
+    free(table.slots);
+    free(table.names);
+    free(table.lens);
+    if (map){munmap((void *)map, size);}
+    return status;
+}
+
+//checks for correct usage
+int help(int argc, char *argv[]){
+    if (argc == 1){
+        printf("\nUsage: csv2bin input.csv output.bin\n\nEnter csv2bin -h for usage examples\n\n");
+        return 0;
+    }
+    else if ((!(strcmp(argv[1], "-h"))) || (!(strcmp(argv[1], "--help")))){
+        printf("\ncsv2bin: Converts a transaction CSV into the binary columnar ledger format read by pr1, pr4 and pr4_p.\n\n");
+        printf("CSV file must be in the format: created_at,sender,recipient,amount.\n\n");
+        printf("Usage: csv2bin [input] [output]. Replace [input] with the name of the CSV file and [output] with the name of the binary file to write.\n\n");
+        return 0;
+    }
+    else if (argc != 3){
+        printf("\nTakes two arguments. (%d) arguments were given\n\nUsage: csv2bin input.csv output.bin\n\nEnter csv2bin -h for usage examples\n\n", (argc - 1));
+        return 0;
+    }
+    return 1;
+}
+
+//main is called with two arguments: CSV filename, binary filename
+int main(int argc, char *argv[]) {
+    int status = 0;
+
+    if (help(argc, argv)){
+        status = csv2bin(argv[1], argv[2]);
+        if (status){
+            fprintf(stderr, "csv2bin: could not convert %s to %s (error %d)\n", argv[1], argv[2], status);
+        }
+    }
+
+    return status;
+}